@@ -0,0 +1,423 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdio.h>
+
+namespace checkpoint {
+
+constexpr uint32_t VERSION = 2;
+constexpr char MAGIC[4] = {'C', 'K', 'P', 'T'};
+
+// shorter runs of zero bytes are cheaper to keep inside literals
+constexpr size_t MIN_ZERO_RUN = 8;
+
+struct image_header {
+	uint32_t time;
+	uint32_t tick;
+	int32_t price_update_tick;
+	uint32_t rng_size;
+	uint64_t data_size;
+	uint64_t seed;
+};
+
+// map goes before the container, so new things do not move it
+// rng state is text and goes last
+void capture(game::state& game, std::vector<std::byte>& image) {
+	auto record = game.data.make_serialize_record_checkpoint();
+	auto data_size = game.data.serialize_size(record);
+
+	auto rng_text = game::save_rng(game);
+
+	image_header header {
+		game.time,
+		game.tick,
+		(int32_t)game.price_update_tick,
+		(uint32_t)rng_text.size(),
+		data_size,
+		game.seed
+	};
+
+	image.resize(sizeof(image_header) + game::WORLD_AREA_TILES + data_size + rng_text.size());
+	auto output = image.data();
+	memcpy(output, &header, sizeof(image_header));
+	output += sizeof(image_header);
+	memcpy(output, game.map.height.data(), game::WORLD_AREA_TILES);
+	output += game::WORLD_AREA_TILES;
+	game.data.serialize(output, record);
+	memcpy(output, rng_text.data(), rng_text.size());
+}
+
+// fnv-1a
+uint64_t hash_bytes(std::byte const* data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ (uint64_t)data[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+uint64_t state_hash(game::state& game, std::vector<std::byte>& image) {
+	capture(game, image);
+	return hash_bytes(image.data(), image.size());
+}
+
+bool restore(game::state& game, std::vector<std::byte> const& image) {
+	image_header header;
+	if (image.size() < sizeof(image_header)) {
+		return false;
+	}
+	memcpy(&header, image.data(), sizeof(image_header));
+	if (image.size() != sizeof(image_header) + game::WORLD_AREA_TILES + header.data_size + header.rng_size) {
+		return false;
+	}
+
+	auto input = image.data() + sizeof(image_header);
+	memcpy(game.map.height.data(), input, game::WORLD_AREA_TILES);
+	input += game::WORLD_AREA_TILES;
+
+	dcon::load_record loaded;
+	auto data_end = input + header.data_size;
+	game.data.deserialize(input, data_end, loaded);
+	input = data_end;
+
+	if (!game::load_rng(game, input, header.rng_size)) {
+		return false;
+	}
+
+	game.seed = header.seed;
+	game.time = header.time;
+	game.tick = header.tick;
+	game.price_update_tick = header.price_update_tick;
+
+	game::rebuild_derived(game);
+	return true;
+}
+
+// content defined chunks: a boundary depends on the bytes before it, not on its offset,
+// so when a column grows or shrinks only the chunks around the change differ from the previous save
+constexpr size_t MIN_CHUNK = 2 << 10;
+constexpr size_t MAX_CHUNK = 64 << 10;
+constexpr uint64_t CHUNK_MASK = (8 << 10) - 1;
+// worst case of the zero run encoding: one pair of counts per literal byte
+constexpr size_t MAX_ENCODED_CHUNK = MAX_CHUNK * 9;
+// checked before anything is allocated for an image
+constexpr uint64_t MAX_IMAGE_SIZE = 1ull << 30;
+
+constexpr std::array<uint64_t, 256> make_gear() {
+	std::array<uint64_t, 256> result {};
+	uint64_t x = 0;
+	for (auto& item : result) {
+		x += 0x9e3779b97f4a7c15ull;
+		auto z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		item = z ^ (z >> 31);
+	}
+	return result;
+}
+
+constexpr auto GEAR = make_gear();
+
+struct file_header {
+	char magic[4];
+	uint32_t version;
+	// new for every full save, incremental saves carry the id of the chain they extend
+	uint64_t chain_id;
+	uint32_t sequence;
+	// sequence of the save this one applies to, equal to sequence for full saves
+	uint32_t base_sequence;
+	uint64_t image_size;
+	uint64_t chunks;
+};
+
+// chunks follow the header in the order of the image
+struct chunk_entry {
+	uint64_t hash;
+	uint32_t size;
+	// zero when the chunk is taken from the image of the save this one applies to,
+	// otherwise this many encoded bytes follow the entry
+	uint32_t encoded_size;
+};
+
+void find_chunks(std::vector<std::byte> const& image, std::vector<chunk>& chunks) {
+	chunks.clear();
+	size_t start = 0;
+	uint64_t rolling = 0;
+	for (size_t i = 0; i < image.size(); i++) {
+		rolling = (rolling << 1) + GEAR[(uint8_t)image[i]];
+		auto size = i + 1 - start;
+		if (
+			i + 1 == image.size()
+			|| size >= MAX_CHUNK
+			|| (size >= MIN_CHUNK && (rolling & CHUNK_MASK) == 0)
+		) {
+			chunks.push_back({hash_bytes(image.data() + start, size), start, (uint32_t)size});
+			start = i + 1;
+			rolling = 0;
+		}
+	}
+}
+
+template<typename T>
+void append(std::vector<std::byte>& out, T const& value) {
+	auto at = out.size();
+	out.resize(at + sizeof(T));
+	memcpy(out.data() + at, &value, sizeof(T));
+}
+
+// pairs of (zero bytes, literal bytes) counts, each followed by the literal bytes
+void encode_chunk(std::byte const* input, size_t size, std::vector<std::byte>& out) {
+	size_t i = 0;
+	while (i < size) {
+		auto zeros_start = i;
+		while (i < size && input[i] == std::byte {0}) {
+			i++;
+		}
+		auto literals_start = i;
+		while (i < size) {
+			if (input[i] != std::byte {0}) {
+				i++;
+				continue;
+			}
+			auto run_end = i;
+			while (run_end < size && input[run_end] == std::byte {0}) {
+				run_end++;
+			}
+			if (run_end - i >= MIN_ZERO_RUN || run_end == size) {
+				break;
+			}
+			i = run_end;
+		}
+		append(out, (uint32_t)(literals_start - zeros_start));
+		append(out, (uint32_t)(i - literals_start));
+		out.insert(out.end(), input + literals_start, input + i);
+	}
+}
+
+bool decode_chunk(std::byte const* input, size_t input_size, std::byte* output, size_t size) {
+	size_t read = 0;
+	size_t written = 0;
+	while (read < input_size) {
+		uint32_t counts[2];
+		if (input_size - read < sizeof(counts)) {
+			return false;
+		}
+		memcpy(counts, input + read, sizeof(counts));
+		read += sizeof(counts);
+		if (
+			(size_t)counts[0] + counts[1] > size - written
+			|| counts[1] > input_size - read
+		) {
+			return false;
+		}
+		memset(output + written, 0, counts[0]);
+		written += counts[0];
+		memcpy(output + written, input + read, counts[1]);
+		written += counts[1];
+		read += counts[1];
+	}
+	return written == size;
+}
+
+bool write_file(writer& data, std::string const& path, uint32_t sequence, uint32_t base_sequence) {
+	auto incremental = sequence != base_sequence;
+	find_chunks(data.image, data.chunks);
+
+	std::vector<std::byte> body;
+	size_t written = 0;
+	for (auto& item : data.chunks) {
+		auto header_at = body.size();
+		append(body, chunk_entry {});
+		chunk_entry entry {item.hash, item.size, 0};
+
+		auto known = incremental ? data.previous_chunks.find(item.hash) : data.previous_chunks.end();
+		if (known == data.previous_chunks.end() || known->second != item.size) {
+			encode_chunk(data.image.data() + item.offset, item.size, body);
+			entry.encoded_size = (uint32_t)(body.size() - header_at - sizeof(chunk_entry));
+			written++;
+		}
+		memcpy(body.data() + header_at, &entry, sizeof(chunk_entry));
+	}
+	data.last_chunks_written = written;
+
+	file_header header {
+		{MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]},
+		VERSION,
+		data.chain_id,
+		sequence,
+		base_sequence,
+		data.image.size(),
+		data.chunks.size()
+	};
+
+	// written next to the target first, so a crash never leaves a torn checkpoint behind
+	auto temporary = path + ".tmp";
+	auto file = fopen(temporary.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	auto ok =
+		fwrite(&header, sizeof(file_header), 1, file) == 1
+		&& fwrite(body.data(), 1, body.size(), file) == body.size();
+	ok = fclose(file) == 0 && ok;
+	if (!ok) {
+		remove(temporary.c_str());
+		return false;
+	}
+	remove(path.c_str());
+	if (rename(temporary.c_str(), path.c_str()) != 0) {
+		return false;
+	}
+
+	data.previous_chunks.clear();
+	for (auto& item : data.chunks) {
+		data.previous_chunks[item.hash] = item.size;
+	}
+	return true;
+}
+
+writer::~writer() {
+	wait(*this);
+}
+
+bool wait(writer& data) {
+	if (data.worker.joinable()) {
+		data.worker.join();
+	}
+	return data.last_succeeded;
+}
+
+uint64_t new_chain_id() {
+	std::random_device device;
+	auto now = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+	return (((uint64_t)device() << 32) | device()) ^ now;
+}
+
+void save(writer& data, game::state& game, std::string const& path, bool incremental) {
+	wait(data);
+	capture(game, data.image);
+
+	incremental = incremental && data.last_succeeded && !data.previous_chunks.empty();
+	auto base_sequence = data.sequence;
+	data.sequence++;
+	auto sequence = data.sequence;
+	if (!incremental) {
+		base_sequence = sequence;
+		data.chain_id = new_chain_id();
+	}
+
+	data.worker = std::thread([&data, path, sequence, base_sequence]() {
+		data.last_succeeded = write_file(data, path, sequence, base_sequence);
+	});
+}
+
+// chain of images while loading, the previous one provides chunks which were not stored again
+struct chain_state {
+	uint64_t chain_id = 0;
+	uint32_t sequence = 0;
+	std::vector<std::byte> image;
+	std::vector<chunk> chunks;
+	std::vector<std::byte> previous;
+	std::vector<chunk> previous_chunks;
+	std::unordered_map<uint64_t, size_t> previous_index;
+};
+
+bool read_chunks(FILE* file, file_header const& header, chain_state& chain) {
+	chain.image.clear();
+	chain.chunks.clear();
+	std::vector<std::byte> encoded;
+	for (uint64_t i = 0; i < header.chunks; i++) {
+		chunk_entry entry;
+		if (
+			fread(&entry, sizeof(chunk_entry), 1, file) != 1
+			|| entry.size == 0
+			|| entry.size > MAX_CHUNK
+			|| entry.size > header.image_size - chain.image.size()
+		) {
+			return false;
+		}
+
+		auto offset = chain.image.size();
+		if (entry.encoded_size == 0) {
+			auto known = chain.previous_index.find(entry.hash);
+			if (known == chain.previous_index.end()) {
+				return false;
+			}
+			auto& source = chain.previous_chunks[known->second];
+			if (source.size != entry.size) {
+				return false;
+			}
+			chain.image.insert(chain.image.end(), chain.previous.begin() + source.offset, chain.previous.begin() + source.offset + source.size);
+		} else {
+			if (entry.encoded_size > MAX_ENCODED_CHUNK) {
+				return false;
+			}
+			encoded.resize(entry.encoded_size);
+			chain.image.resize(offset + entry.size);
+			if (
+				fread(encoded.data(), 1, encoded.size(), file) != encoded.size()
+				|| !decode_chunk(encoded.data(), encoded.size(), chain.image.data() + offset, entry.size)
+				|| hash_bytes(chain.image.data() + offset, entry.size) != entry.hash
+			) {
+				return false;
+			}
+		}
+		chain.chunks.push_back({entry.hash, offset, entry.size});
+	}
+	return chain.image.size() == header.image_size;
+}
+
+// replaces the image of the chain with the one stored in the file
+bool read_file(std::string const& path, chain_state& chain, bool first) {
+	auto file = fopen(path.c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+
+	file_header header {};
+	auto ok =
+		fread(&header, sizeof(file_header), 1, file) == 1
+		&& memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+		&& header.version == VERSION
+		&& header.image_size <= MAX_IMAGE_SIZE
+		&& header.chunks <= header.image_size
+		&& (
+			first
+			? header.base_sequence == header.sequence
+			: header.chain_id == chain.chain_id && header.base_sequence == chain.sequence
+		);
+
+	if (ok) {
+		std::swap(chain.image, chain.previous);
+		std::swap(chain.chunks, chain.previous_chunks);
+		chain.previous_index.clear();
+		for (size_t i = 0; i < chain.previous_chunks.size(); i++) {
+			chain.previous_index[chain.previous_chunks[i].hash] = i;
+		}
+		ok = read_chunks(file, header, chain);
+	}
+	fclose(file);
+
+	chain.chain_id = header.chain_id;
+	chain.sequence = header.sequence;
+	return ok;
+}
+
+bool load(game::state& game, std::vector<std::string> const& paths) {
+	if (paths.empty()) {
+		return false;
+	}
+	chain_state chain;
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (!read_file(paths[i], chain, i == 0)) {
+			return false;
+		}
+	}
+	return restore(game, chain.image);
+}
+
+}
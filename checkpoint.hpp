@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "game.hpp"
+
+// saving and resuming the world
+// the tick thread only copies the state into a flat image, which is cheap;
+// chunking, compressing and writing happen on a background thread
+//
+// the image is cut into chunks at boundaries which depend on its content:
+// a full checkpoint stores all of them, an incremental one only chunks
+// which the previous save did not have, so births and deaths which shift
+// later columns do not make every later chunk new
+// incremental checkpoints can only be loaded on top of the chain they were made from
+
+namespace checkpoint {
+
+struct chunk {
+	uint64_t hash;
+	size_t offset;
+	uint32_t size;
+};
+
+struct writer {
+	// image being written and its chunks
+	std::vector<std::byte> image;
+	std::vector<chunk> chunks;
+	// hash -> size of chunks of the last finished save
+	std::unordered_map<uint64_t, uint32_t> previous_chunks;
+	std::thread worker;
+
+	// random for every full save, so incremental saves of another run are rejected
+	uint64_t chain_id = 0;
+	// counts saves, incremental ones refer to the save before them
+	uint32_t sequence = 0;
+	bool last_succeeded = true;
+	size_t last_chunks_written = 0;
+
+	~writer();
+};
+
+// waits for the previous save, captures the world and returns without waiting for the disk
+// falls back to a full save when there is nothing to be incremental against
+void save(writer& data, game::state& game, std::string const& path, bool incremental);
+// blocks until the save in flight is on disk, returns whether it succeeded
+bool wait(writer& data);
+
+// hash of everything a checkpoint stores, equal worlds have equal hashes
+// image is scratch space which can be reused between calls
+uint64_t state_hash(game::state& game, std::vector<std::byte>& image);
+
+// the world must come from game::init: ids created there are assumed to be the same
+// paths are a full checkpoint followed by incremental ones in the order they were saved
+bool load(game::state& game, std::vector<std::string> const& paths);
+
+}
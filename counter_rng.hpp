@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+
+#include "data_ids.hpp"
+#include "data.hpp"
+
+// stateless random numbers: every draw is a hash of (seed, stream, tick, entity)
+// so draws do not depend on the order in which entities are visited,
+// and the same world replays bit for bit no matter how a pass is split between threads
+
+namespace counter_rng {
+
+// every use of randomness gets its own stream, so adding a draw somewhere does not shift the others
+enum class stream : uint32_t {
+	wander,
+	birth,
+	regrowth
+};
+
+inline uint64_t splitmix64(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+// squares keys should be odd with well mixed bits
+inline uint64_t make_key(uint64_t seed, stream which) {
+	return splitmix64(seed ^ splitmix64((uint64_t)which)) | 1;
+}
+
+// Widynski's squares: four rounds of squaring a counter scaled by the key
+inline uint32_t squares32(uint64_t counter, uint64_t key) {
+	uint64_t y = counter * key;
+	uint64_t z = y + key;
+	uint64_t x = y;
+	x = x * x + y;
+	x = (x >> 32) | (x << 32);
+	x = x * x + z;
+	x = (x >> 32) | (x << 32);
+	x = x * x + y;
+	x = (x >> 32) | (x << 32);
+	return (uint32_t)((x * x + z) >> 32);
+}
+
+inline uint64_t make_counter(uint32_t tick, int32_t entity) {
+	return ((uint64_t)tick << 32) | (uint32_t)entity;
+}
+
+// in [0, 1)
+inline float uniform(uint64_t key, uint32_t tick, int32_t entity) {
+	return (float)(squares32(make_counter(tick, entity), key) >> 8) * (1.f / 16777216.f);
+}
+
+inline float uniform(uint64_t key, uint32_t tick, dcon::thing_id entity) {
+	return uniform(key, tick, entity.index());
+}
+
+// one draw per lane, for ids handed out by execute_parallel_over_* and execute_serial_over_*
+template<typename V, typename TAGS>
+auto uniform_lanes(uint64_t key, uint32_t tick, TAGS entities) {
+	return ve::apply([key, tick](V entity) {
+		return uniform(key, tick, entity.index());
+	}, entities);
+}
+
+template<typename V>
+auto uniform(uint64_t key, uint32_t tick, ve::tagged_vector<V> entities) {
+	return uniform_lanes<V>(key, tick, entities);
+}
+
+template<typename V>
+auto uniform(uint64_t key, uint32_t tick, ve::contiguous_tags<V> entities) {
+	return uniform_lanes<V>(key, tick, entities);
+}
+
+template<typename V>
+auto uniform(uint64_t key, uint32_t tick, ve::partial_contiguous_tags<V> entities) {
+	return uniform_lanes<V>(key, tick, entities);
+}
+
+template<typename V>
+auto uniform(uint64_t key, uint32_t tick, ve::unaligned_contiguous_tags<V> entities) {
+	return uniform_lanes<V>(key, tick, entities);
+}
+
+}
@@ -0,0 +1,123 @@
+#include "events.hpp"
+
+#include <chrono>
+
+namespace events {
+
+// the drainer sleeps this long when the ring is empty
+constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(5);
+
+log::~log() {
+	stop(*this);
+}
+
+void push(log& data, event const& item) {
+	if (!data.running.load(std::memory_order_relaxed)) {
+		return;
+	}
+	auto head = data.head.load(std::memory_order_relaxed);
+	if (head - data.tail.load(std::memory_order_acquire) >= RING_CAPACITY) {
+		data.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	data.ring[head % RING_CAPACITY] = item;
+	data.head.store(head + 1, std::memory_order_release);
+}
+
+// consumer side, returns the number of drained events
+size_t drain(log& data, std::vector<event>& batch) {
+	batch.clear();
+	auto tail = data.tail.load(std::memory_order_relaxed);
+	auto head = data.head.load(std::memory_order_acquire);
+	for (auto i = tail; i < head; i++) {
+		batch.push_back(data.ring[i % RING_CAPACITY]);
+	}
+	data.tail.store(head, std::memory_order_release);
+
+	if (batch.empty()) {
+		return 0;
+	}
+
+	if (data.file) {
+		fwrite(batch.data(), sizeof(event), batch.size(), data.file);
+	}
+
+	std::lock_guard lock {data.history_mutex};
+	for (auto& item : batch) {
+		data.history.push_back(item);
+	}
+	while (data.history.size() > HISTORY_SIZE) {
+		data.history.pop_front();
+	}
+	return batch.size();
+}
+
+void drain_loop(log& data) {
+	std::vector<event> batch;
+	batch.reserve(RING_CAPACITY);
+	while (data.running.load(std::memory_order_relaxed)) {
+		if (drain(data, batch) == 0) {
+			std::this_thread::sleep_for(DRAIN_INTERVAL);
+		}
+	}
+	// whatever was pushed before running was cleared
+	drain(data, batch);
+}
+
+bool start(log& data, const char* path) {
+	if (data.running) {
+		return true;
+	}
+	if (path) {
+		data.file = fopen(path, "wb");
+		if (!data.file) {
+			return false;
+		}
+	}
+	data.ring.resize(RING_CAPACITY);
+	data.running = true;
+	data.drainer = std::thread([&data]() { drain_loop(data); });
+	return true;
+}
+
+void stop(log& data) {
+	if (!data.running) {
+		return;
+	}
+	data.running = false;
+	data.drainer.join();
+	if (data.file) {
+		fclose(data.file);
+		data.file = nullptr;
+	}
+}
+
+void recent(log& data, std::vector<event>& result) {
+	std::lock_guard lock {data.history_mutex};
+	result.assign(data.history.begin(), data.history.end());
+}
+
+const char* get_name(event_type type) {
+	switch (type) {
+		case event_type::buy:
+			return "buys";
+		case event_type::order:
+			return "orders";
+		case event_type::buy_on_loan:
+			return "buys with a loan";
+		case event_type::sell:
+			return "sells";
+		case event_type::sell_on_promise:
+			return "sells for a promise of payment";
+		case event_type::repair_started:
+			return "starts repairing a weapon";
+		case event_type::repair_completed:
+			return "completes repairing a weapon";
+		case event_type::food_made:
+			return "makes food";
+		default:
+			return "unknown";
+	}
+}
+
+}
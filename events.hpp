@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// typed records of what happened during ticks
+// the tick pushes them into a lock-free ring, a background thread drains the ring
+// into a binary file and a short history; text is only produced by whoever reads them
+
+namespace events {
+
+enum class event_type : uint8_t {
+	buy,
+	order,
+	buy_on_loan,
+	sell,
+	sell_on_promise,
+	repair_started,
+	repair_completed,
+	food_made,
+	count
+};
+
+// written to the log file as is, ids are dcon indices and -1 for none
+// no implicit padding: the reserved bytes are zero, so records are deterministic
+struct event {
+	uint32_t tick;
+	int32_t actor;
+	int32_t counterparty;
+	int32_t commodity;
+	float amount;
+	float price;
+	event_type type;
+	uint8_t reserved[3] = {};
+};
+static_assert(sizeof(event) == 28 && std::is_trivially_copyable_v<event>, "event is written to files byte by byte");
+
+constexpr size_t RING_CAPACITY = 1 << 14;
+constexpr size_t HISTORY_SIZE = 1024;
+
+struct log {
+	// one producer, the thread running the tick, and one consumer, the drainer
+	std::vector<event> ring;
+	std::atomic<size_t> head {0};
+	std::atomic<size_t> tail {0};
+	// events which found the ring full
+	std::atomic<size_t> dropped {0};
+
+	std::atomic<bool> running {false};
+	std::thread drainer;
+	FILE* file = nullptr;
+
+	// latest events for viewers, oldest first
+	std::mutex history_mutex;
+	std::deque<event> history;
+
+	~log();
+};
+
+// without a path the events only reach the history
+bool start(log& data, const char* path = nullptr);
+// drains what is left and closes the file
+void stop(log& data);
+
+// never blocks, does nothing while the log is stopped
+void push(log& data, event const& item);
+
+void recent(log& data, std::vector<event>& result);
+
+const char* get_name(event_type type);
+
+}
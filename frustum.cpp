@@ -5,6 +5,9 @@
 
 #include "glm/geometric.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 frustum::frustum(glm::mat4 const & view_projection)
 {
 	glm::mat4 m = glm::inverse(view_projection);
@@ -48,3 +51,50 @@ frustum::frustum(glm::mat4 const & view_projection)
 		e(3, 7),
 	};
 }
+
+static bool separated(frustum const & f, aabb const & box, glm::vec3 const & axis)
+{
+	// degenerate axis from parallel edges
+	if (glm::dot(axis, axis) < 1e-12f)
+		return false;
+
+	float f_min = glm::dot(f.vertices[0], axis);
+	float f_max = f_min;
+	for (std::size_t i = 1; i < 8; ++i)
+	{
+		float d = glm::dot(f.vertices[i], axis);
+		f_min = std::min(f_min, d);
+		f_max = std::max(f_max, d);
+	}
+
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 half = (box.max - box.min) * 0.5f;
+	float c = glm::dot(center, axis);
+	float r = std::abs(axis.x) * half.x + std::abs(axis.y) * half.y + std::abs(axis.z) * half.z;
+
+	return f_max < c - r || c + r < f_min;
+}
+
+bool intersects(frustum const & f, aabb const & box)
+{
+	static const std::array<glm::vec3, 3> box_axes = {
+		glm::vec3{1.f, 0.f, 0.f},
+		glm::vec3{0.f, 1.f, 0.f},
+		glm::vec3{0.f, 0.f, 1.f},
+	};
+
+	for (auto const & axis : box_axes)
+		if (separated(f, box, axis))
+			return false;
+
+	for (auto const & normal : f.face_normals)
+		if (separated(f, box, normal))
+			return false;
+
+	for (auto const & box_axis : box_axes)
+		for (auto const & edge : f.edge_directions)
+			if (separated(f, box, glm::cross(box_axis, edge)))
+				return false;
+
+	return true;
+}
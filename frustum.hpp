@@ -18,3 +18,12 @@ struct frustum
 
 	frustum(glm::mat4 const & view_projection);
 };
+
+struct aabb
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// separating axis test, works for perspective and orthographic (light) frusta
+bool intersects(frustum const & f, aabb const & box);
@@ -0,0 +1,2024 @@
+#include "game.hpp"
+#include "counter_rng.hpp"
+
+#include <assert.h>
+#include <cmath>
+#include <numbers>
+#include <sstream>
+#include <stdio.h>
+
+namespace game {
+
+char get_height(map_state& data, int x, int y) {
+	auto c_x = x + WORLD_RADIUS * CHUNK_SIZE;
+	auto c_y = y + WORLD_RADIUS * CHUNK_SIZE;
+	return data.height[c_x * WORLD_SIZE_TILES + c_y];
+}
+void set_height(map_state& data, int x, int y, char value) {
+	auto c_x = x + WORLD_RADIUS * CHUNK_SIZE;
+	auto c_y = y + WORLD_RADIUS * CHUNK_SIZE;
+	auto& height = data.height[c_x * WORLD_SIZE_TILES + c_y];
+	if (height == value) {
+		return;
+	}
+	height = value;
+
+	auto chunk_x = c_x / CHUNK_SIZE - WORLD_RADIUS;
+	auto chunk_y = c_y / CHUNK_SIZE - WORLD_RADIUS;
+	auto local_x = c_x % CHUNK_SIZE;
+	auto local_y = c_y % CHUNK_SIZE;
+
+	mark_dirty(data, chunk_x, chunk_y);
+	// walls of the neighbouring chunk depend on tiles along the edge
+	if (local_x == 0) {
+		mark_dirty(data, chunk_x - 1, chunk_y);
+	}
+	if (local_x == CHUNK_SIZE - 1) {
+		mark_dirty(data, chunk_x + 1, chunk_y);
+	}
+	if (local_y == 0) {
+		mark_dirty(data, chunk_x, chunk_y - 1);
+	}
+	if (local_y == CHUNK_SIZE - 1) {
+		mark_dirty(data, chunk_x, chunk_y + 1);
+	}
+}
+
+void mark_dirty(map_state& data, int chunk_x, int chunk_y) {
+	if (
+		chunk_x < -WORLD_RADIUS || chunk_x >= WORLD_RADIUS
+		|| chunk_y < -WORLD_RADIUS || chunk_y >= WORLD_RADIUS
+	) {
+		return;
+	}
+	auto index = chunk_index(chunk_x, chunk_y);
+	if (data.dirty[index]) {
+		return;
+	}
+	data.dirty[index] = true;
+	data.dirty_chunks.push_back(index);
+}
+
+bool pop_dirty_chunk(map_state& data, int& chunk_x, int& chunk_y) {
+	if (data.dirty_chunks.empty()) {
+		return false;
+	}
+	// oldest first
+	auto index = data.dirty_chunks.front();
+	data.dirty_chunks.pop_front();
+	data.dirty[index] = false;
+	chunk_x = index / WORLD_SIZE - WORLD_RADIUS;
+	chunk_y = index % WORLD_SIZE - WORLD_RADIUS;
+	return true;
+}
+
+void clear_dirty_chunks(map_state& data) {
+	for (auto index : data.dirty_chunks) {
+		data.dirty[index] = false;
+	}
+	data.dirty_chunks.clear();
+}
+
+int spatial_cell_coord(float x) {
+	auto c = (int)floorf(x / (float)SPATIAL_CELL_SIZE) + SPATIAL_GRID_SIZE / 2;
+	return std::clamp(c, 0, SPATIAL_GRID_SIZE - 1);
+}
+
+void spatial_remove(spatial_grid& grid, dcon::thing_id id) {
+	auto i = (size_t)id.index();
+	if (i >= grid.cell.size() || grid.cell[i] == 0) {
+		return;
+	}
+	auto c = grid.cell[i] - 1;
+	auto prev = grid.prev[i];
+	auto next = grid.next[i];
+	if (prev) {
+		grid.next[prev.index()] = next;
+	} else {
+		grid.head[c] = next;
+	}
+	if (next) {
+		grid.prev[next.index()] = prev;
+	}
+	grid.next[i] = {};
+	grid.prev[i] = {};
+	grid.cell[i] = 0;
+}
+
+void spatial_move(spatial_grid& grid, dcon::thing_id id, float x, float y) {
+	auto i = (size_t)id.index();
+	if (i >= grid.cell.size()) {
+		grid.next.resize(i + 1);
+		grid.prev.resize(i + 1);
+		grid.cell.resize(i + 1, 0);
+	}
+
+	auto cx = spatial_cell_coord(x);
+	auto cy = spatial_cell_coord(y);
+	auto c = cx * SPATIAL_GRID_SIZE + cy;
+
+	grid.min_cx = std::min(grid.min_cx, cx);
+	grid.min_cy = std::min(grid.min_cy, cy);
+	grid.max_cx = std::max(grid.max_cx, cx);
+	grid.max_cy = std::max(grid.max_cy, cy);
+
+	if (grid.cell[i] == c + 1) {
+		return;
+	}
+
+	spatial_remove(grid, id);
+
+	auto first = grid.head[c];
+	grid.next[i] = first;
+	if (first) {
+		grid.prev[first.index()] = id;
+	}
+	grid.head[c] = id;
+	grid.cell[i] = c + 1;
+}
+
+void spatial_sync(state& game, dcon::thing_id id) {
+	spatial_move(game.grid, id, game.data.thing_get_x(id), game.data.thing_get_y(id));
+}
+
+// only things which changed their cell are relinked
+void spatial_update(state& game) {
+	auto& grid = game.grid;
+	grid.min_cx = SPATIAL_GRID_SIZE;
+	grid.min_cy = SPATIAL_GRID_SIZE;
+	grid.max_cx = -1;
+	grid.max_cy = -1;
+	game.data.for_each_thing([&](auto id) {
+		spatial_sync(game, id);
+	});
+}
+
+std::string save_rng(state& game) {
+	std::ostringstream text;
+	text << game.rng << ' ' << game.uniform << ' ' << game.normal;
+	return text.str();
+}
+
+bool load_rng(state& game, std::byte const* data, size_t size) {
+	std::istringstream text(std::string((char const*)data, size));
+	text >> game.rng >> game.uniform >> game.normal;
+	return !text.fail();
+}
+
+void rebuild_derived(state& game) {
+	game.grid = {};
+	spatial_update(game);
+	clear_dirty_chunks(game.map);
+	for (int x = -WORLD_RADIUS; x < WORLD_RADIUS; x++) {
+		for (int y = -WORLD_RADIUS; y < WORLD_RADIUS; y++) {
+			mark_dirty(game.map, x, y);
+		}
+	}
+}
+
+std::string get_name (state& game, dcon::commodity_id commodity) {
+	if (game.potion == commodity) {
+		return "Potion";
+	} else if (game.coins == commodity) {
+		return  "Coins";
+	} else if (game.potion_material == commodity) {
+		return "Potion material";
+	} else if (game.raw_food == commodity) {
+		return  "Food ingredients";
+	} else if (game.prepared_food == commodity) {
+		return  "Food";
+	} else if (game.weapon_service == commodity) {
+		return "Weapon service";
+	}
+	return "Unknown " + std::to_string(commodity.index());
+}
+
+std::string get_name (state& game, dcon::activity_id activity) {
+	if (!activity) {
+		return "Idle";
+	}
+	if (game.ai.getting_food == activity) {
+		return "Looking for food";
+	} else if (game.ai.prepare_food == activity) {
+		return  "Preparing food";
+	} else if (game.ai.shopping == activity) {
+		return "Trading";
+	} else if (game.ai.weapon_repair == activity) {
+		return  "Repair weapon";
+	} else if (game.ai.working == activity) {
+		return  "Working";
+	}
+	return "Unknown " + std::to_string(activity.index());
+}
+
+std::string describe(state& game, events::event const& item) {
+	auto result = "tick " + std::to_string(item.tick) + ": character " + std::to_string(item.actor) + " " + events::get_name(item.type);
+	if (item.commodity >= 0) {
+		result += " " + get_name(game, dcon::commodity_id{dcon::commodity_id::value_base_t(item.commodity)});
+	}
+	if (item.counterparty >= 0) {
+		result += " with character " + std::to_string(item.counterparty);
+	}
+	char price[32];
+	snprintf(price, sizeof(price), " at %.2f", item.price);
+	return result + price;
+}
+
+enum class change_hp_result {
+	dead, alive
+};
+
+change_hp_result change_hp(state& game, dcon::thing_id target, int change) {
+	auto hp  = game.data.thing_get_hp(target);
+	game.data.thing_set_hp(target, hp + change);
+	if (hp + change > 0) {
+		return change_hp_result::alive;
+	} else {
+		auto kind = game.data.thing_get_kind(target);
+		auto preserve = game.data.kind_get_preserved_after_death(kind);
+		if (!preserve) {
+			spatial_remove(game.grid, target);
+			game.data.delete_thing(target);
+		}
+		return change_hp_result::dead;
+	}
+}
+
+void transaction(state& game, dcon::character_id A, dcon::character_id B, dcon::commodity_id C, float amount) {
+	assert(amount >= 0.f);
+	auto i_A = game.data.character_get_inventory(A, C);
+	auto i_B = game.data.character_get_inventory(B, C);
+
+	assert(i_A >= amount);
+	game.data.character_set_inventory(A, C, i_A - amount);
+	game.data.character_set_inventory(B, C, i_B + amount);
+}
+void log_event(
+	state& game, events::event_type type,
+	dcon::character_id actor, dcon::character_id counterparty, dcon::commodity_id commodity, float price
+) {
+	events::push(game.events, {
+		game.tick,
+		(int32_t)actor.index(),
+		(int32_t)counterparty.index(),
+		(int32_t)commodity.index(),
+		1.f,
+		price,
+		type
+	});
+}
+void delayed_transaction(state& game, dcon::character_id A, dcon::character_id B, dcon::commodity_id C, float amount) {
+	auto delayed = game.data.get_delayed_transaction_by_transaction_pair(A, B);
+	if (delayed) {
+		auto mul = 1;
+		if (A == game.data.delayed_transaction_get_members(delayed, 1)) {
+			mul = -1;
+		}
+		auto debt = game.data.delayed_transaction_get_balance(delayed, C);
+		game.data.delayed_transaction_set_balance(delayed, C, debt + (float)mul * amount);
+	} else {
+		delayed = game.data.force_create_delayed_transaction(A, B);
+		game.data.delayed_transaction_set_balance(delayed, C, amount);
+	}
+}
+enum class move_result {
+	completed, failed, in_progress
+};
+
+namespace ai {
+
+// recording of mutations: decisions never write into the state directly
+
+void set_action_type(commands& buffer, dcon::character_id cid, dcon::activity_id activity) {
+	buffer.list.push_back({.type = command_type::set_action_type, .character = cid, .activity = activity});
+}
+
+void set_action_timer(commands& buffer, dcon::character_id cid, float timer) {
+	buffer.list.push_back({.type = command_type::set_action_timer, .character = cid, .value = timer});
+}
+
+void reset_action(commands& buffer, dcon::character_id cid) {
+	set_action_timer(buffer, cid, 0.f);
+	set_action_type(buffer, cid, {});
+}
+
+void change_inventory(commands& buffer, dcon::character_id cid, dcon::commodity_id commodity, float amount) {
+	buffer.list.push_back({.type = command_type::change_inventory, .character = cid, .commodity = commodity, .value = amount});
+}
+
+void transaction(commands& buffer, dcon::character_id A, dcon::character_id B, dcon::commodity_id C, float amount) {
+	buffer.list.push_back({.type = command_type::transaction, .character = A, .other = B, .commodity = C, .value = amount});
+}
+
+void scale_price_belief_sell(commands& buffer, dcon::character_id cid, dcon::commodity_id commodity, float mult) {
+	buffer.list.push_back({.type = command_type::scale_price_belief_sell, .character = cid, .commodity = commodity, .value = mult});
+}
+
+void change_weapon_quality(commands& buffer, dcon::character_id cid, float amount) {
+	buffer.list.push_back({.type = command_type::change_weapon_quality, .character = cid, .value = amount});
+}
+
+void move(commands& buffer, dcon::thing_id thing, float x, float y) {
+	buffer.list.push_back({.type = command_type::move, .thing = thing, .x = x, .y = y});
+}
+
+void enter(commands& buffer, dcon::thing_id thing, dcon::building_id building) {
+	buffer.list.push_back({.type = command_type::enter, .thing = thing, .building = building});
+}
+
+void leave(commands& buffer, dcon::thing_id thing) {
+	buffer.list.push_back({.type = command_type::leave, .thing = thing});
+}
+
+void set_hunt_target(commands& buffer, dcon::thing_id hunter, dcon::thing_id target) {
+	buffer.list.push_back({.type = command_type::set_hunt_target, .thing = hunter, .target = target});
+}
+
+void attack(commands& buffer, dcon::thing_id hunter, dcon::thing_id target) {
+	buffer.list.push_back({.type = command_type::attack, .thing = hunter, .target = target});
+}
+
+void set_hunger(commands& buffer, dcon::thing_id thing, float hunger) {
+	buffer.list.push_back({.type = command_type::set_hunger, .thing = thing, .value = hunger});
+}
+
+void log_event(
+	commands& buffer, events::event_type type,
+	dcon::character_id actor, dcon::character_id counterparty, dcon::commodity_id commodity,
+	float amount, float price
+) {
+	buffer.list.push_back({
+		.type = command_type::log_event,
+		.character = actor,
+		.other = counterparty,
+		.commodity = commodity,
+		.value = amount,
+		.x = price,
+		.event = type
+	});
+}
+
+void read_character(commands& buffer, dcon::character_id cid) {
+	if (cid) {
+		buffer.reads.push_back({.type = read_type::character, .index = cid.index()});
+	}
+}
+
+void read_thing(commands& buffer, dcon::thing_id thing) {
+	if (thing) {
+		buffer.reads.push_back({.type = read_type::thing, .index = thing.index()});
+	}
+}
+
+// every cell which has a point closer than the radius to (x, y)
+void read_cells(commands& buffer, float x, float y, float radius) {
+	buffer.reads.push_back({
+		.type = read_type::cells,
+		.min_cx = spatial_cell_coord(x - radius),
+		.min_cy = spatial_cell_coord(y - radius),
+		.max_cx = spatial_cell_coord(x + radius),
+		.max_cy = spatial_cell_coord(y + radius)
+	});
+}
+
+void end_decision(commands& buffer, dcon::character_id cid) {
+	buffer.decisions.push_back({cid, (uint32_t)buffer.list.size(), (uint32_t)buffer.reads.size()});
+}
+
+void clear(commands& buffer) {
+	buffer.list.clear();
+	buffer.reads.clear();
+	buffer.decisions.clear();
+}
+
+void mark_cell(write_marks& marks, float x, float y) {
+	auto cell = spatial_cell_coord(x) * SPATIAL_GRID_SIZE + spatial_cell_coord(y);
+	if (marks.cells[cell] != marks.epoch) {
+		marks.cells[cell] = marks.epoch;
+		marks.dirty_cells.push_back(cell);
+	}
+}
+
+void mark_character(write_marks& marks, dcon::character_id cid) {
+	if (cid && (size_t)cid.index() < marks.characters.size()) {
+		marks.characters[cid.index()] = marks.epoch;
+	}
+}
+
+// the cell it is in is written too: searches over the grid could see the change
+void mark_thing(state& game, write_marks& marks, dcon::thing_id thing) {
+	if (!game.data.thing_is_valid(thing)) {
+		return;
+	}
+	if ((size_t)thing.index() < marks.things.size()) {
+		marks.things[thing.index()] = marks.epoch;
+	}
+	mark_cell(marks, game.data.thing_get_x(thing), game.data.thing_get_y(thing));
+}
+
+void begin_tracking(state& game) {
+	auto& marks = game.ai_marks;
+	marks.tracking = true;
+	marks.epoch++;
+	marks.redecided = 0;
+	marks.dirty_cells.clear();
+	marks.characters.resize(game.data.character_size());
+	marks.things.resize(game.data.thing_size());
+	marks.cells.resize(SPATIAL_GRID_AREA);
+}
+
+void end_tracking(state& game) {
+	game.ai_marks.tracking = false;
+}
+
+bool cells_unchanged(write_marks& marks, read const& area) {
+	auto width = (size_t)(area.max_cx - area.min_cx + 1);
+	auto height = (size_t)(area.max_cy - area.min_cy + 1);
+	// whichever is smaller: the rectangle or the list of written cells
+	if (width * height <= marks.dirty_cells.size()) {
+		for (auto cx = area.min_cx; cx <= area.max_cx; cx++) {
+			for (auto cy = area.min_cy; cy <= area.max_cy; cy++) {
+				if (marks.cells[cx * SPATIAL_GRID_SIZE + cy] == marks.epoch) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	for (auto cell : marks.dirty_cells) {
+		auto cx = cell / SPATIAL_GRID_SIZE;
+		auto cy = cell % SPATIAL_GRID_SIZE;
+		if (cx >= area.min_cx && cx <= area.max_cx && cy >= area.min_cy && cy <= area.max_cy) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool reads_unchanged(write_marks& marks, commands const& buffer, size_t begin, size_t end) {
+	for (auto i = begin; i < end; i++) {
+		auto& item = buffer.reads[i];
+		switch (item.type) {
+			case read_type::character:
+				if ((size_t)item.index < marks.characters.size() && marks.characters[item.index] == marks.epoch) {
+					return false;
+				}
+				break;
+			case read_type::thing:
+				if ((size_t)item.index < marks.things.size() && marks.things[item.index] == marks.epoch) {
+					return false;
+				}
+				break;
+			case read_type::cells:
+				if (!cells_unchanged(marks, item)) {
+					return false;
+				}
+				break;
+		}
+	}
+	return true;
+}
+
+int attack_damage(state& game, dcon::thing_id hunter) {
+	auto one_which_embodies = game.data.thing_get_embodier_from_embodiment(hunter);
+	auto damage = 10;
+	if (one_which_embodies) {
+		auto weapon = game.data.character_get_weapon_quality(one_which_embodies);
+		damage *= (1.f + weapon);
+	}
+	return damage;
+}
+
+void apply_attack(state& game, dcon::thing_id hunter, dcon::thing_id target) {
+	// in parallel mode someone else could have already killed it
+	if (!game.data.thing_is_valid(target)) {
+		return;
+	}
+
+	auto one_which_embodies = game.data.thing_get_embodier_from_embodiment(hunter);
+	auto damage = attack_damage(game, hunter);
+
+	if (one_which_embodies) {
+		auto quality = game.data.character_get_weapon_quality(one_which_embodies);
+		game.data.character_set_weapon_quality(one_which_embodies, quality * 0.95f);
+	}
+
+	auto result = change_hp(game, target, -damage);
+
+	if (result == change_hp_result::dead) {
+		if (one_which_embodies) {
+			auto food = game.data.character_get_inventory(one_which_embodies, game.raw_food);
+			game.data.character_set_inventory(one_which_embodies, game.raw_food, food + 1.f);
+		} else {
+			game.data.thing_set_hp(hunter, game.data.thing_get_hp(hunter) + 5);
+			game.data.thing_set_hunger(hunter, game.data.thing_get_hunger(hunter) - BASE_FOOD_NUTRITION);
+		}
+		auto selection = game.data.thing_get_hunt_target_as_hunter(hunter);
+		if (selection) {
+			game.data.delete_hunt_target(selection);
+		}
+	}
+}
+
+void mark_writes(state& game, command const& c) {
+	auto& marks = game.ai_marks;
+	switch (c.type) {
+		case command_type::set_action_type:
+		case command_type::set_action_timer:
+		case command_type::change_inventory:
+		case command_type::scale_price_belief_sell:
+		case command_type::change_weapon_quality:
+			mark_character(marks, c.character);
+			break;
+		case command_type::transaction:
+			mark_character(marks, c.character);
+			mark_character(marks, c.other);
+			break;
+		case command_type::move:
+		case command_type::enter:
+		case command_type::leave:
+		case command_type::set_hunt_target:
+		case command_type::set_hunger:
+			mark_thing(game, marks, c.thing);
+			break;
+		case command_type::attack:
+			mark_thing(game, marks, c.thing);
+			mark_thing(game, marks, c.target);
+			mark_character(marks, game.data.thing_get_embodier_from_embodiment(c.thing));
+			break;
+		case command_type::log_event:
+			break;
+	}
+}
+
+void apply_command(state& game, command const& c) {
+	if (game.ai_marks.tracking) {
+		mark_writes(game, c);
+	}
+	switch (c.type) {
+		case command_type::set_action_type:
+			game.data.character_set_action_type(c.character, c.activity);
+			break;
+		case command_type::set_action_timer:
+			game.data.character_set_action_timer(c.character, c.value);
+			break;
+		case command_type::change_inventory: {
+			auto inventory = game.data.character_get_inventory(c.character, c.commodity);
+			game.data.character_set_inventory(c.character, c.commodity, inventory + c.value);
+			break;
+		}
+		case command_type::transaction:
+			game::transaction(game, c.character, c.other, c.commodity, c.value);
+			break;
+		case command_type::scale_price_belief_sell: {
+			auto price = game.data.character_get_price_belief_sell(c.character, c.commodity);
+			game.data.character_set_price_belief_sell(c.character, c.commodity, price * c.value);
+			break;
+		}
+		case command_type::change_weapon_quality: {
+			auto quality = game.data.character_get_weapon_quality(c.character);
+			game.data.character_set_weapon_quality(c.character, quality + c.value);
+			break;
+		}
+		case command_type::move:
+			if (!game.data.thing_is_valid(c.thing)) {
+				break;
+			}
+			game.data.thing_set_x(c.thing, c.x);
+			game.data.thing_set_y(c.thing, c.y);
+			spatial_sync(game, c.thing);
+			break;
+		case command_type::enter:
+			game.data.force_create_guest(c.thing, c.building);
+			break;
+		case command_type::leave: {
+			auto guest = game.data.thing_get_guest(c.thing);
+			if (guest) {
+				game.data.delete_guest(guest);
+			}
+			break;
+		}
+		case command_type::set_hunt_target:
+			if (game.data.thing_is_valid(c.target)) {
+				game.data.force_create_hunt_target(c.thing, c.target);
+			}
+			break;
+		case command_type::attack:
+			apply_attack(game, c.thing, c.target);
+			break;
+		case command_type::set_hunger:
+			game.data.thing_set_hunger(c.thing, c.value);
+			break;
+		case command_type::log_event:
+			events::push(game.events, {
+				game.tick,
+				(int32_t)c.character.index(),
+				(int32_t)c.other.index(),
+				(int32_t)c.commodity.index(),
+				c.value,
+				c.x,
+				c.event
+			});
+			break;
+	}
+	// a move writes the cell it ends in as well
+	if (game.ai_marks.tracking && c.type == command_type::move) {
+		mark_thing(game, game.ai_marks, c.thing);
+	}
+}
+
+void apply(state& game, commands& buffer) {
+	for (auto& c : buffer.list) {
+		apply_command(game, c);
+	}
+	clear(buffer);
+}
+
+namespace update {
+void character(state& game, commands& buffer, dcon::character_id cid);
+}
+
+// decisions made ahead of time, applied in the order they were recorded
+// the result is the same as deciding and applying one character after another
+void apply_decisions(state& game, commands& buffer) {
+	auto& marks = game.ai_marks;
+	size_t commands_begin = 0;
+	size_t reads_begin = 0;
+	for (auto& item : buffer.decisions) {
+		if (reads_unchanged(marks, buffer, reads_begin, item.reads_end)) {
+			for (auto i = commands_begin; i < item.commands_end; i++) {
+				apply_command(game, buffer.list[i]);
+			}
+		} else {
+			marks.redecided++;
+			update::character(game, game.ai_retry, item.character);
+			apply(game, game.ai_retry);
+		}
+		commands_begin = item.commands_end;
+		reads_begin = item.reads_end;
+	}
+	clear(buffer);
+}
+
+}
+
+move_result move_to(
+	state& game, ai::commands& buffer, dcon::thing_id cid,
+	float x, float y, float target_x, float target_y
+) {
+	auto dx = target_x - x;
+	auto dy = target_y - y;
+	auto distance = sqrtf(dx * dx + dy * dy);
+
+	auto kind = game.data.thing_get_kind(cid);
+	auto speed = game.data.kind_get_speed(kind);
+
+	if (distance < speed) {
+		ai::move(buffer, cid, target_x, target_y);
+		return move_result::completed;
+	} else {
+		ai::move(buffer, cid, x + dx / distance * speed, y + dy / distance * speed);
+		return move_result::in_progress;
+	}
+	return move_result::failed;
+}
+
+
+move_result move_to(state& game, ai::commands& buffer, dcon::thing_id cid, dcon::building_id target) {
+	auto target_x = game.data.building_get_tile_x(target);
+	auto target_y = game.data.building_get_tile_y(target);
+
+	auto guest_in = game.data.thing_get_guest_location_from_guest(cid);
+
+	if (guest_in == target) {
+		return move_result::completed;
+	} else if (guest_in) {
+		ai::leave(buffer, cid);
+		return move_result::in_progress;
+	} else {
+		auto x = game.data.thing_get_x(cid);
+		auto y = game.data.thing_get_y(cid);
+		auto result = move_to(game, buffer, cid, x, y, (float)target_x, (float)target_y);
+		if (result == move_result::completed) {
+			ai::enter(buffer, cid, target);
+			return move_result::completed;
+		}
+		return result;
+	}
+}
+
+
+// x and y are updated to the position after exit
+void exit_the_guested(state& game, ai::commands& buffer, dcon::thing_id one_which_exits, float& x, float& y) {
+	auto guest_in = game.data.thing_get_guest_location_from_guest(one_which_exits);
+	if (guest_in) {
+		x = (float)game.data.building_get_tile_x(guest_in);
+		y = (float)game.data.building_get_tile_y(guest_in);
+		ai::leave(buffer, one_which_exits);
+		ai::move(buffer, one_which_exits, x, y);
+	}
+}
+
+
+enum class hunt_result {
+	moving_to_target, attacking_target, seeking_target, success
+};
+
+hunt_result hunt(state& game, ai::commands& buffer, dcon::thing_id hunter) {
+	auto x = game.data.thing_get_x(hunter);
+	auto y = game.data.thing_get_y(hunter);
+	exit_the_guested(game, buffer, hunter, x, y);
+
+	auto selection = game.data.thing_get_hunt_target_as_hunter(hunter);
+	auto target = game.data.hunt_target_get_hunted(selection);
+
+	auto kind_of_the_hunter = game.data.thing_get_kind(hunter);
+
+	if (!target){
+		target = spatial_nearest(game, x, y, 1000.f, [&](dcon::thing_id candidate) {
+			auto kind_of_the_hunted = game.data.thing_get_kind(candidate);
+			return game.data.get_food_hierarchy_by_consumption_pair(
+					kind_of_the_hunter,
+					kind_of_the_hunted
+				)
+				&& game.data.thing_get_hp(candidate) > 0;
+		});
+
+		// the result changes only when something closer than it changes
+		auto searched = 1000.f;
+		if (target) {
+			auto tx = game.data.thing_get_x(target);
+			auto ty = game.data.thing_get_y(target);
+			searched = std::sqrt((tx - x) * (tx - x) + (ty - y) * (ty - y));
+		}
+		ai::read_cells(buffer, x, y, searched + (float)SPATIAL_CELL_SIZE);
+
+		if (target) {
+			ai::set_hunt_target(buffer, hunter, target);
+		} else {
+			return hunt_result::seeking_target;
+		}
+	}
+
+	ai::read_thing(buffer, target);
+	auto tx = game.data.thing_get_x(target);
+	auto ty = game.data.thing_get_y(target);
+
+	auto d = (tx - x) * (tx - x) + (ty - y) * (ty - y);
+
+	if (d < 0.2f) {
+		ai::attack(buffer, hunter, target);
+		// exact: decisions are applied right away or made again when the target changed in between
+		if (game.data.thing_get_hp(target) - ai::attack_damage(game, hunter) > 0) {
+			return hunt_result::attacking_target;
+		}
+		return hunt_result::success;
+	} else {
+		move_to(game, buffer, hunter, x, y, tx, ty);
+		return hunt_result::moving_to_target;
+	}
+}
+
+void repair_weapon(state& game, ai::commands& buffer, dcon::character_id cid, dcon::character_id master) {
+	auto timer = game.data.character_get_action_timer(cid);
+	auto weapon_repair_price = game.data.character_get_price_belief_sell(master, game.weapon_service);
+	if (timer == 0) {
+		ai::log_event(buffer, events::event_type::repair_started, cid, master, game.weapon_service, 1.f, weapon_repair_price);
+		ai::set_action_timer(buffer, cid, timer + 1);
+		ai::transaction(buffer, cid, master, game.coins, weapon_repair_price);
+		ai::scale_price_belief_sell(buffer, master, game.weapon_service, 1.05f);
+	} else if (timer > 4) {
+		ai::log_event(buffer, events::event_type::repair_completed, cid, master, game.weapon_service, 1.f, weapon_repair_price);
+		ai::change_weapon_quality(buffer, cid, 0.3f);
+		ai::reset_action(buffer, cid);
+		auto body = game.data.character_get_body_from_embodiment(cid);
+		ai::leave(buffer, body);
+	} else {
+		ai::set_action_timer(buffer, cid, timer + 1);
+	}
+}
+
+void make_potion(state& game, ai::commands& buffer, dcon::character_id cid) {
+	auto material = game.data.character_get_inventory(cid, game.potion_material);
+	assert(material >= 1.f);
+	auto timer = game.data.character_get_action_timer(cid);
+	if (timer > 6) {
+		ai::change_inventory(buffer, cid, game.potion_material, -1.f);
+		ai::change_inventory(buffer, cid, game.potion, 1.f);
+		ai::reset_action(buffer, cid);
+	} else {
+		ai::set_action_timer(buffer, cid, timer + 1);
+	}
+}
+
+void increase_hp(state& game, dcon::thing_id target, int value) {
+	auto hp = game.data.thing_get_hp(target);
+	auto hp_max = game.data.thing_get_hp_max(target);
+	game.data.thing_set_hp(target, std::min(hp_max, hp + value));
+}
+
+// returns the new value of the action timer
+float prepare_food(state& game, ai::commands& buffer, dcon::character_id cid) {
+	auto material = game.data.character_get_inventory(cid, game.raw_food);
+	assert(material >= 1.f);
+	auto timer = game.data.character_get_action_timer(cid);
+	if (timer > 1) {
+		// auto skill = game.data.character_get_skills(cid, )
+		auto skill_bonus = (float)(int)(game.data.character_get_skills(cid, game.skills.cooking) / 0.3);
+		ai::change_inventory(buffer, cid, game.raw_food, -1.f);
+		ai::change_inventory(buffer, cid, game.prepared_food, 1.f + skill_bonus);
+		ai::reset_action(buffer, cid);
+		return 0.f;
+	} else {
+		ai::set_action_timer(buffer, cid, timer + 1);
+		return timer + 1;
+	}
+}
+
+// returns the new value of the action timer
+float gather_potion_material(state& game, ai::commands& buffer, dcon::character_id cid) {
+	auto timer = game.data.character_get_action_timer(cid);
+	if (timer > 3) {
+		ai::change_inventory(buffer, cid, game.potion_material, 1.f);
+		ai::reset_action(buffer, cid);
+		return 0.f;
+	} else {
+		ai::set_action_timer(buffer, cid, timer + 1);
+		return timer + 1;
+	}
+}
+
+void eat(state& game, dcon::character_id cid) {
+	auto food = game.data.character_get_inventory(cid, game.prepared_food);
+	auto body = game.data.character_get_body_from_embodiment(cid);
+	auto hunger = game.data.thing_get_hunger(body);
+	if (food >= 1.f) {
+		game.data.character_set_inventory(cid, game.prepared_food, food - 1);
+		game.data.thing_set_hunger(body, hunger - BASE_FOOD_NUTRITION);
+		increase_hp(game, body, 10);
+	}
+}
+void drink_potion(state& game, dcon::character_id cid) {
+	auto potions = game.data.character_get_inventory(cid, game.potion);
+	auto body = game.data.character_get_body_from_embodiment(cid);
+	auto hp = game.data.thing_get_hp(body);
+	auto hp_max = game.data.thing_get_hp_max(body);
+	if (hp * 2 < hp_max && potions >= 1.f) {
+		game.data.character_set_inventory(cid, game.potion, potions - 1);
+		increase_hp(game, body, 10);
+	}
+}
+
+
+
+namespace ai {
+
+namespace triggers {
+
+bool desire_weapon_repair(state& game, dcon::character_id cid, dcon::character_id master) {
+	if (game.data.character_get_weapon_quality(cid) > 2.f) {
+		return false;
+	}
+
+	auto coins = game.data.character_get_inventory(cid, game.coins);
+	auto weapon_repair_price = game.data.character_get_price_belief_sell(master, game.weapon_service);
+	if (weapon_repair_price * 3.f > coins) {
+		return false;
+	}
+
+	return true;
+}
+
+bool desire_buy_food(state& game, dcon::character_id cid) {
+	auto ai_type = game.data.character_get_ai_type(cid);
+	auto food = game.data.character_get_inventory(cid, game.prepared_food);
+	auto food_target = game.data.ai_model_get_stockpile_target(ai_type,  game.prepared_food);
+	auto favourite_inn = game.data.character_get_favourite_inn(cid);
+	auto favourute_innkeeper = game.data.building_get_owner_from_ownership(favourite_inn);
+	auto coins = game.data.character_get_inventory(cid, game.coins);
+
+	auto in_stock = game.data.character_get_inventory(favourute_innkeeper, game.prepared_food);
+
+	if (food_target < food) {
+		return false;
+	}
+
+	if (in_stock < 1.f) {
+		return false;
+	}
+
+	auto food_price = game.data.character_get_price_belief_sell(favourute_innkeeper, game.prepared_food);
+
+	if (food_price * 2.f > coins) {
+		return false;
+	}
+
+	return true;
+}
+
+bool hunter_desire_shopping(state& game, dcon::character_id cid) {
+	auto ai_type = game.data.character_get_ai_type(cid);
+
+	auto loot  = game.data.character_get_inventory(cid, game.raw_food);
+	auto loot_target = game.data.ai_model_get_stockpile_target(ai_type, game.raw_food);
+
+	auto bottom_price = game.data.character_get_price_belief_buy(cid, game.prepared_food) / 5.f;
+
+	auto favourite_shop = game.data.character_get_favourite_shop(cid);
+	auto favourute_shopkeeper = game.data.building_get_owner_from_ownership(favourite_shop);
+	auto price_shop_buy = game.data.character_get_price_belief_buy(favourute_shopkeeper, game.raw_food);
+
+	return (loot - loot_target > 3 && price_shop_buy > bottom_price);
+}
+
+bool alchemist_desire_shopping(state& game, dcon::character_id cid) {
+	auto ai_type = game.data.character_get_ai_type(cid);
+
+	auto produced  = game.data.character_get_inventory(cid, game.potion);
+	auto produced_target = game.data.ai_model_get_stockpile_target(ai_type, game.potion);
+
+	auto materials = game.data.character_get_inventory(cid, game.potion_material);
+	auto materials_target = game.data.ai_model_get_stockpile_target(ai_type, game.potion_material);
+
+	auto bottom_price = game.data.character_get_price_belief_buy(cid, game.prepared_food) / 5.f;
+
+	auto favourite_shop = game.data.character_get_favourite_shop(cid);
+	auto favourute_shopkeeper = game.data.building_get_owner_from_ownership(favourite_shop);
+	auto price_shop_buy = game.data.character_get_price_belief_buy(favourute_shopkeeper, game.potion);
+
+	return (produced - produced_target > 3 && price_shop_buy > bottom_price) || materials_target > materials;
+}
+
+}
+
+namespace update {
+
+void alchemist(state& game, commands& buffer, dcon::character_id cid) {
+	auto body = game.data.character_get_body_from_embodiment(cid);
+	auto x = game.data.thing_get_x(body);
+	auto y = game.data.thing_get_y(body);
+	auto coins = game.data.character_get_inventory(cid, game.coins);
+	auto action = game.data.character_get_action_type(cid);
+	auto ai_type = game.data.character_get_ai_type(cid);
+
+	assert(ai_type == game.personality.alchemist);
+
+	auto favourite_shop = game.data.character_get_favourite_shop(cid);
+	auto favourite_inn = game.data.character_get_favourite_inn(cid);
+
+	auto favourute_shopkeeper = game.data.building_get_owner_from_ownership(favourite_shop);
+
+	if (!action) {
+		if (
+			ai::triggers::alchemist_desire_shopping(game, cid)
+		) {
+			action = game.ai.shopping;
+		} else if (
+			ai::triggers::desire_buy_food(game, cid)
+		) {
+			action = game.ai.getting_food;
+		} else {
+			action = game.ai.working;
+		}
+		set_action_type(buffer, cid, action);
+	}
+
+	if (action == game.ai.shopping) {
+		if (!ai::triggers::alchemist_desire_shopping(game, cid)) {
+			reset_action(buffer, cid);
+		}
+		auto move = move_to(game, buffer, body, favourite_shop);
+		return;
+	}
+	if (action == game.ai.getting_food) {
+		if (!ai::triggers::desire_buy_food(game, cid)) {
+			reset_action(buffer, cid);
+		}
+		auto move = move_to(game, buffer, body, favourite_inn);
+		return;
+	}
+	if (action == game.ai.working) {
+		auto potion_price = game.data.character_get_price_belief_buy(favourute_shopkeeper, game.potion);
+		auto potion_material_cost = game.data.character_get_price_belief_sell(favourute_shopkeeper, game.potion_material);
+		if (
+			game.data.character_get_inventory(cid, game.potion_material) >= 1.f
+			&& potion_price > potion_material_cost * 2.f
+		) {
+			make_potion(game, buffer, cid);
+		} else {
+			reset_action(buffer, cid);
+		}
+		return;
+	}
+	set_action_timer(buffer, cid, 0.f);
+}
+
+void meatbug(state& game, commands& buffer, dcon::thing_id body) {
+	auto hunger = game.data.thing_get_hunger(body);
+	if (hunger > 500) {
+		auto result = hunt(game, buffer, body);
+		if (result == hunt_result::success) {
+			set_hunger(buffer, body, hunger - 300.f);
+		}
+	}
+}
+
+void hunter(state& game, commands& buffer, dcon::character_id cid) {
+	auto body = game.data.character_get_body_from_embodiment(cid);
+	auto x = game.data.thing_get_x(body);
+	auto y = game.data.thing_get_y(body);
+	auto coins = game.data.character_get_inventory(cid, game.coins);
+	auto action = game.data.character_get_action_type(cid);
+	auto ai_type = game.data.character_get_ai_type(cid);
+
+	assert(ai_type == game.personality.hunter);
+
+	auto favourite_weapons_shop = game.data.character_get_favourite_shop_weapons(cid);
+	auto favourite_weapons_shop_owner = game.data.building_get_owner_from_ownership(favourite_weapons_shop);
+	auto weapon_repair_price = game.data.character_get_price_belief_sell(favourite_weapons_shop_owner, game.weapon_service);
+
+	auto favourite_shop = game.data.character_get_favourite_shop(cid);
+	auto favourite_inn = game.data.character_get_favourite_inn(cid);
+
+
+
+	if (!action) {
+		if (
+			ai::triggers::hunter_desire_shopping(game, cid)
+		) {
+			set_action_type(buffer, cid, game.ai.shopping);
+		} else if (
+			ai::triggers::desire_weapon_repair(game, cid, favourite_weapons_shop_owner)
+		) {
+			set_action_type(buffer, cid, game.ai.weapon_repair);
+		} else if (
+			game.data.thing_get_hunger(body) > BASE_FOOD_NUTRITION * 3
+			&& game.data.character_get_inventory(cid, game.raw_food) >= 1.f
+		) {
+			set_action_type(buffer, cid, game.ai.prepare_food);
+		} else if (
+			ai::triggers::desire_buy_food(game, cid)
+		) {
+			set_action_type(buffer, cid, game.ai.getting_food);
+		} else {
+			set_action_type(buffer, cid, game.ai.working);
+		}
+	}
+
+	auto guest_in = game.data.thing_get_guest_location_from_guest(body);
+	auto timer = game.data.character_get_action_timer(cid);
+
+	if (action == game.ai.weapon_repair) {
+		if (
+			ai::triggers::desire_weapon_repair(game, cid, favourite_weapons_shop_owner) || timer > 0
+		) {
+			auto move = move_to(game, buffer, body, favourite_weapons_shop);
+			if (move == move_result::completed) {
+				repair_weapon(game, buffer, cid, favourite_weapons_shop_owner);
+			}
+		} else {
+			reset_action(buffer, cid);
+		}
+		return;
+	} else if (action == game.ai.prepare_food) {
+		if (game.data.character_get_inventory(cid, game.raw_food) >= 1.f) {
+			prepare_food(game, buffer, cid);
+		} else {
+			reset_action(buffer, cid);
+		}
+		return;
+	} else if (action == game.ai.working) {
+		auto result = hunt(game, buffer, body);
+		if (result == hunt_result::success) {
+			reset_action(buffer, cid);
+		}
+		return;
+	} else if (action == game.ai.shopping) {
+		if (!ai::triggers::hunter_desire_shopping(game, cid)) {
+			reset_action(buffer, cid);
+		}
+		auto move = move_to(game, buffer, body, favourite_shop);
+		return;
+	} else if (action == game.ai.getting_food) {
+		if (!ai::triggers::desire_buy_food(game, cid)) {
+			reset_action(buffer, cid);
+		}
+		auto move = move_to(game, buffer, body, favourite_inn);
+		return;
+	}
+	set_action_timer(buffer, cid, 0.f);
+}
+
+void herbalist(state& game, commands& buffer, dcon::character_id cid) {
+	auto timer = gather_potion_material(game, buffer, cid);
+	set_action_timer(buffer, cid, timer + 1);
+}
+
+void innkeeper(state& game, commands& buffer, dcon::character_id cid) {
+	auto timer = game.data.character_get_action_timer(cid);
+	auto material_cost = game.data.character_get_price_belief_buy(cid, game.raw_food);
+	auto production_cost = game.data.character_get_price_belief_sell(cid, game.prepared_food);
+	if (
+		game.data.character_get_inventory(cid, game.raw_food) >= 1.f
+		&& production_cost > material_cost
+	) {
+		log_event(buffer, events::event_type::food_made, cid, {}, game.prepared_food, 1.f, production_cost);
+		timer = prepare_food(game, buffer, cid);
+	}
+	set_action_timer(buffer, cid, timer + 1);
+}
+
+void character(state& game, commands& buffer, dcon::character_id cid) {
+	// besides static data decisions look at the character, its body,
+	// owners of its favourite buildings and what hunt records itself
+	read_character(buffer, cid);
+	read_thing(buffer, game.data.character_get_body_from_embodiment(cid));
+	read_character(buffer, game.data.building_get_owner_from_ownership(game.data.character_get_favourite_shop(cid)));
+	read_character(buffer, game.data.building_get_owner_from_ownership(game.data.character_get_favourite_inn(cid)));
+	read_character(buffer, game.data.building_get_owner_from_ownership(game.data.character_get_favourite_shop_weapons(cid)));
+
+	auto model = game.data.character_get_ai_type(cid);
+	if (model == game.personality.hunter) {
+		hunter(game, buffer, cid);
+	} else if (model == game.personality.alchemist) {
+		alchemist(game, buffer, cid);
+	} else if (model == game.personality.herbalist) {
+		herbalist(game, buffer, cid);
+	} else if (model == game.personality.innkeeper) {
+		innkeeper(game, buffer, cid);
+	}
+}
+
+}
+
+}
+
+dcon::commodity_id create_commodity(state& game) {
+	auto commodity = game.data.create_commodity();
+	auto count = game.data.commodity_size();
+	game.data.character_resize_price_belief_buy(count);
+	game.data.character_resize_price_belief_sell(count);
+	game.data.character_resize_inventory(count);
+	game.data.ai_model_resize_stockpile_target(count);
+	game.data.delayed_transaction_resize_balance(count);
+	return commodity;
+}
+
+dcon::skill_id create_skill(state& game) {
+	auto skill = game.data.create_skill();
+	game.data.character_resize_skills(game.data.skill_size());
+	return skill;
+}
+
+void init(state& game) {
+	game.ai.getting_food = game.data.create_activity();
+	game.ai.shopping = game.data.create_activity();
+	game.ai.weapon_repair = game.data.create_activity();
+	game.ai.working = game.data.create_activity();
+	game.ai.prepare_food = game.data.create_activity();
+
+	game.coins = create_commodity(game);
+	game.potion_material = create_commodity(game);
+	game.potion = create_commodity(game);
+	game.raw_food = create_commodity(game);
+	game.prepared_food = create_commodity(game);
+	game.weapon_service = create_commodity(game);
+
+	game.skills.cooking = create_skill(game);
+
+	game.inn = game.data.create_building_model();
+	game.shop = game.data.create_building_model();
+	game.shop_weapon = game.data.create_building_model();
+
+	game.special_kinds.human = game.data.create_kind();
+	game.data.kind_set_size(game.special_kinds.human, 1.f);
+	game.data.kind_set_speed(game.special_kinds.human, 0.03f);
+
+	auto rat = game.data.create_kind();
+	game.data.kind_set_size(rat, 0.5f);
+	game.data.kind_set_speed(rat, 0.08f);
+
+
+	game.special_kinds.meatflower = game.data.create_kind();
+	game.data.kind_set_size(game.special_kinds.meatflower, 0.1f);
+	game.data.kind_set_speed(game.special_kinds.meatflower, 0.0f);
+	game.data.kind_set_preserved_after_death(game.special_kinds.meatflower, true);
+
+	game.special_kinds.meatbug = game.data.create_kind();
+	game.data.kind_set_size(game.special_kinds.meatbug, 0.4f);
+	game.data.kind_set_speed(game.special_kinds.meatbug, 0.02f);
+
+	game.special_kinds.meatbug_queen = game.data.create_kind();
+	game.data.kind_set_size(game.special_kinds.meatbug_queen, 2.f);
+	game.data.kind_set_speed(game.special_kinds.meatbug_queen, 0.01f);
+
+	game.special_kinds.potion_flower = game.data.create_kind();
+	game.data.kind_set_size(game.special_kinds.potion_flower, 0.1f);
+	game.data.kind_set_speed(game.special_kinds.potion_flower, 0.f);
+	game.data.kind_set_preserved_after_death(game.special_kinds.potion_flower, true);
+
+	game.special_kinds.tree = game.data.create_kind();
+	game.data.kind_set_size(game.special_kinds.tree, 0.2f);
+	game.data.kind_set_speed(game.special_kinds.tree, 0.f);
+	game.data.kind_set_preserved_after_death(game.special_kinds.tree, true);
+
+	game.data.force_create_food_hierarchy(game.special_kinds.human, game.special_kinds.meatbug);
+	game.data.force_create_food_hierarchy(game.special_kinds.human, rat);
+	game.data.force_create_food_hierarchy(rat, game.special_kinds.meatbug);
+	game.data.force_create_food_hierarchy(game.special_kinds.meatbug, game.special_kinds.meatflower);
+	game.data.force_create_food_hierarchy(game.special_kinds.meatbug_queen, game.special_kinds.meatflower);
+	game.data.force_create_food_hierarchy(game.special_kinds.meatbug_queen, game.special_kinds.meatbug);
+
+	{
+		game.personality.hunter = game.data.create_ai_model();
+		game.data.ai_model_set_stockpile_target(game.personality.hunter, game.potion, 7);
+		game.data.ai_model_set_stockpile_target(game.personality.hunter, game.prepared_food, 3);
+	}
+
+	{
+		game.personality.shopkeeper = game.data.create_ai_model();
+		game.data.for_each_commodity([&](auto commodity){
+			if (commodity == game.coins) {
+				return;
+			}
+			game.data.ai_model_set_stockpile_target(game.personality.shopkeeper, commodity, 10);
+		});
+	}
+
+	{
+		game.personality.innkeeper = game.data.create_ai_model();
+		game.data.ai_model_set_stockpile_target(game.personality.innkeeper, game.raw_food, 10);
+		game.data.ai_model_set_stockpile_target(game.personality.innkeeper, game.prepared_food, 5);
+		game.data.ai_model_set_stockpile_target(game.personality.innkeeper, game.potion, 1);
+	}
+
+	{
+		game.personality.alchemist = game.data.create_ai_model();
+		game.data.ai_model_set_stockpile_target(game.personality.alchemist, game.prepared_food, 5);
+		game.data.ai_model_set_stockpile_target(game.personality.alchemist, game.potion_material, 10);
+	}
+
+	{
+		game.personality.weapon_master = game.data.create_ai_model();
+		game.data.ai_model_set_stockpile_target(game.personality.weapon_master, game.prepared_food, 5);
+		game.data.ai_model_set_stockpile_target(game.personality.weapon_master, game.potion, 1);
+	}
+
+	{
+		game.personality.herbalist = game.data.create_ai_model();
+		game.data.ai_model_set_stockpile_target(game.personality.herbalist, game.prepared_food, 5);
+		game.data.ai_model_set_stockpile_target(game.personality.herbalist, game.potion, 1);
+	}
+
+	{
+		auto deliverer_model = game.data.create_ai_model();
+		game.data.ai_model_set_stockpile_target(deliverer_model, game.prepared_food, 5);
+		game.data.ai_model_set_stockpile_target(deliverer_model, game.potion, 1);
+	}
+
+
+	// {
+	// 	auto deliverer = game.data.create_character();
+	// 	game.data.character_set_hp(deliverer, 100);
+	// 	game.data.character_set_hp_max(deliverer, 100);
+	// }
+	for (int i = 0; i < 4; i++) {
+		auto hunter = game.data.create_character();
+		auto hunter_body = game.data.create_thing();
+		game.data.thing_set_kind(hunter_body, game.special_kinds.human);
+		game.data.force_create_embodiment(hunter, hunter_body);
+		game.data.thing_set_hp(hunter_body, 100);
+		game.data.thing_set_hp_max(hunter_body, 100);
+		game.data.character_set_ai_type(hunter, game.personality.hunter);
+		game.data.character_set_weapon_quality(hunter, 1.f);
+		game.data.character_set_inventory(hunter, game.coins, 10);
+	}
+
+	{
+		auto inn = game.data.create_building();
+		game.data.building_set_tile_x(inn, 0);
+		game.data.building_set_tile_y(inn, 0);
+		game.data.building_set_building_model(inn, game.inn);
+
+		auto innkeeper = game.data.create_character();
+		auto innkeeper_body = game.data.create_thing();
+		game.data.thing_set_hp(innkeeper_body, 100);
+		game.data.thing_set_hp_max(innkeeper_body, 100);
+		game.data.thing_set_kind(innkeeper_body, game.special_kinds.human);
+		game.data.force_create_embodiment(innkeeper, innkeeper_body);
+		game.data.character_set_inventory(innkeeper, game.coins, 100);
+		game.data.character_set_ai_type(innkeeper, game.personality.innkeeper);
+		game.data.character_set_skills(innkeeper, game.skills.cooking, 0.3f);
+
+		game.data.force_create_ownership(innkeeper, inn);
+	}
+	{
+		auto shop = game.data.create_building();
+		game.data.building_set_tile_x(shop, 3);
+		game.data.building_set_tile_y(shop, 3);
+		game.data.building_set_building_model(shop, game.shop);
+		auto shop_owner = game.data.create_character();
+		auto body = game.data.create_thing();
+		game.data.thing_set_hp(body, 100);
+		game.data.thing_set_hp_max(body, 100);
+		game.data.thing_set_kind(body, game.special_kinds.human);
+		game.data.force_create_embodiment(shop_owner, body);
+		game.data.character_set_inventory(shop_owner, game.coins, 100);
+		game.data.character_set_ai_type(shop_owner, game.personality.shopkeeper);
+
+		game.data.force_create_ownership(shop_owner, shop);
+	}
+	{
+		auto shop_weapons = game.data.create_building();
+		game.data.building_set_tile_x(shop_weapons, 3);
+		game.data.building_set_tile_y(shop_weapons, 0);
+		game.data.building_set_building_model(shop_weapons, game.shop_weapon);
+		auto weapon_master = game.data.create_character();
+		auto body = game.data.create_thing();
+		game.data.thing_set_hp(body, 100);
+		game.data.thing_set_hp_max(body, 100);
+		game.data.thing_set_kind(body, game.special_kinds.human);
+		game.data.force_create_embodiment(weapon_master, body);
+		game.data.character_set_inventory(weapon_master, game.coins, 10);
+		game.data.character_set_ai_type(weapon_master, game.personality.weapon_master);
+
+		game.data.force_create_ownership(weapon_master, shop_weapons);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		auto alchemist = game.data.create_character();
+		auto body = game.data.create_thing();
+		game.data.thing_set_hp(body, 100);
+		game.data.thing_set_hp_max(body, 100);
+		game.data.thing_set_kind(body, game.special_kinds.human);
+		game.data.force_create_embodiment(alchemist, body);
+		game.data.character_set_inventory(alchemist, game.coins, 100);
+		game.data.character_set_ai_type(alchemist, game.personality.alchemist);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		auto herbalist = game.data.create_character();
+		auto body = game.data.create_thing();
+		game.data.thing_set_hp(body, 100);
+		game.data.thing_set_hp_max(body, 100);
+		game.data.thing_set_kind(body, game.special_kinds.human);
+		game.data.force_create_embodiment(herbalist, body);
+		game.data.character_set_ai_type(herbalist, game.personality.herbalist);
+	}
+
+	game.data.for_each_character([&](auto cid) {
+		game.data.for_each_commodity([&](auto commodity) {
+			game.data.character_set_price_belief_buy(cid, commodity, 1.f);
+			game.data.character_set_price_belief_sell(cid, commodity, 1.f);
+		});
+
+		// select initial favorite shops
+		game.data.for_each_building([&](auto candidate_building){
+			auto candidate = game.data.building_get_owner_from_ownership(candidate_building);
+			dcon::ai_model_id model = game.data.character_get_ai_type(candidate);
+			if (model == game.personality.innkeeper) {
+				game.data.character_set_favourite_inn(cid, candidate_building);
+			}
+			if (model == game.personality.weapon_master) {
+				game.data.character_set_favourite_shop_weapons(cid, candidate_building);
+			}
+			if (model == game.personality.shopkeeper) {
+				game.data.character_set_favourite_shop(cid, candidate_building);
+			}
+		});
+	});
+
+	for (int i = 0; i < 50; i++) {
+		auto queen = game.data.create_thing();
+		game.data.thing_set_kind(queen, game.special_kinds.meatbug_queen);
+		game.data.thing_set_hp(queen, 300);
+		game.data.thing_set_hp_max(queen, 30);
+		game.data.thing_set_x(queen, game.uniform(game.rng) * 100.f - 50.f);
+		game.data.thing_set_y(queen, game.uniform(game.rng) * 100.f - 50.f);
+		game.data.thing_set_direction(queen, game.uniform(game.rng) * std::numbers::pi_v<float> * 2);
+	}
+
+	// spawn trees
+
+	auto forest_x = 30.f;
+	auto forest_y = 30.f;
+
+	for (int i = 0; i < 50; i++) {
+		auto thing = game.data.create_thing();
+		game.data.thing_set_kind(thing, game.special_kinds.tree);
+		game.data.thing_set_hp(thing, 30);
+		game.data.thing_set_hp_max(thing, 30);
+		game.data.thing_set_x(thing, game.normal(game.rng) * 10.f  + forest_x);
+		game.data.thing_set_y(thing, game.normal(game.rng) * 10.f  + forest_y);
+		game.data.thing_set_direction(thing, game.uniform(game.rng) * std::numbers::pi_v<float> * 2);
+	}
+
+	for (int i = 0; i < 2000; i++) {
+		auto flower = game.data.create_thing();
+		game.data.thing_set_kind(flower, game.special_kinds.meatflower);
+		game.data.thing_set_hp(flower, 3);
+		game.data.thing_set_hp_max(flower, 3);
+		game.data.thing_set_x(flower, game.uniform(game.rng) * 100.f - 50.f);
+		game.data.thing_set_y(flower, game.uniform(game.rng) * 100.f - 50.f);
+		game.data.thing_set_direction(flower, game.uniform(game.rng) * std::numbers::pi_v<float> * 2);
+	}
+
+	for (int i = 0; i < WORLD_AREA_TILES; i++) {
+		game.map.height[i] = 0;
+	}
+	game.data.for_each_building([&](auto building) {
+		auto x = game.data.building_get_tile_x(building);
+		auto y = game.data.building_get_tile_y(building);
+
+		set_height(game.map, x, y, 1);
+	});
+
+	spatial_update(game);
+}
+
+namespace market {
+
+order_book& open_book(state& game, dcon::building_id building, dcon::commodity_id commodity) {
+	auto commodities = game.data.commodity_size();
+	auto key = building.index() * commodities + commodity.index();
+	auto existing = game.market.book_index[key];
+	if (existing >= 0) {
+		return game.market.books[existing];
+	}
+
+	if (game.market.books_count == game.market.books.size()) {
+		game.market.books.emplace_back();
+	}
+	game.market.book_index[key] = (int32_t)game.market.books_count;
+	auto& book = game.market.books[game.market.books_count++];
+	book.building = building;
+	book.commodity = commodity;
+	book.owner = game.data.building_get_owner_from_ownership(building);
+	book.bids.clear();
+	book.asks.clear();
+	return book;
+}
+
+void close_books(state& game) {
+	auto commodities = game.data.commodity_size();
+	for (size_t i = 0; i < game.market.books_count; i++) {
+		auto& book = game.market.books[i];
+		game.market.book_index[book.building.index() * commodities + book.commodity.index()] = -1;
+	}
+	game.market.books_count = 0;
+}
+
+// the market where the character deals with the commodity, if it can trade there right now
+dcon::building_id market_of(state& game, dcon::character_id cid, dcon::thing_id body, dcon::commodity_id commodity) {
+	auto shop = game.data.character_get_favourite_shop(cid);
+	auto action = game.ai.shopping;
+	if (commodity == game.prepared_food) {
+		shop = game.data.character_get_favourite_inn(cid);
+		action = game.ai.getting_food;
+	}
+
+	auto ai_type = game.data.character_get_ai_type(cid);
+	if (
+		ai_type == game.personality.hunter
+		|| ai_type == game.personality.alchemist
+	) {
+		if (game.data.character_get_action_type(cid) != action) {
+			return {};
+		}
+		if (game.data.thing_get_guest_location_from_guest(body) != shop) {
+			return {};
+		}
+	}
+
+	if (game.data.building_get_owner_from_ownership(shop) == cid) {
+		return {};
+	}
+	return shop;
+}
+
+// returns false when the character cannot reach any market
+bool post_orders(state& game, dcon::character_id cid) {
+	bool active = false;
+	auto body = game.data.character_get_body_from_embodiment(cid);
+	auto ai_type = game.data.character_get_ai_type(cid);
+
+	// most of the time hunters and alchemists are away from the shops
+	if (
+		(ai_type == game.personality.hunter || ai_type == game.personality.alchemist)
+		&& !game.data.thing_get_guest_location_from_guest(body)
+	) {
+		return false;
+	}
+	auto bottom_price = game.data.character_get_price_belief_buy(cid, game.prepared_food) / 5.f;
+
+	game.data.for_each_commodity([&](auto commodity) {
+		if (commodity == game.coins) {
+			return;
+		}
+		if (commodity == game.weapon_service) {
+			return;
+		}
+
+		auto shop = market_of(game, cid, body, commodity);
+		if (!shop) {
+			return;
+		}
+
+		active = true;
+		auto& book = open_book(game, shop, commodity);
+
+		auto target = game.data.ai_model_get_stockpile_target(ai_type, commodity);
+		auto inventory = game.data.character_get_inventory(cid, commodity);
+		auto desired_price_buy = game.data.character_get_price_belief_buy(cid, commodity);
+		auto desired_price_sell = game.data.character_get_price_belief_sell(cid, commodity);
+		auto price_shop_buy = game.data.character_get_price_belief_buy(book.owner, commodity);
+
+		float ordered = 0.f;
+		auto delayed = game.data.get_delayed_transaction_by_transaction_pair(book.owner, cid);
+		if (delayed) {
+			auto debt = game.data.delayed_transaction_get_balance(delayed, commodity);
+			if (game.data.delayed_transaction_get_members(delayed, 0) != book.owner) {
+				debt = -debt;
+			}
+			ordered += debt;
+		}
+
+		// every unit bought, ordered or taken on loan brings the stockpile one unit closer to the target
+		int buy = 0;
+		while (buy < TRADE_UNITS_PER_TICK && target > inventory + ordered + (float)buy) {
+			buy++;
+		}
+		if (buy > 0) {
+			book.bids.push_back({cid, desired_price_buy, buy});
+		}
+
+		int sell = 0;
+		if (price_shop_buy > bottom_price) {
+			while (sell < TRADE_UNITS_PER_TICK && target < inventory - (float)sell && inventory - (float)sell >= 1.f) {
+				sell++;
+			}
+		}
+		if (sell > 0) {
+			book.asks.push_back({cid, desired_price_sell, sell});
+		}
+	});
+	return active;
+}
+
+void clear(state& game, order_book& book) {
+	auto owner = book.owner;
+	auto commodity = book.commodity;
+	auto price_shop_sell = game.data.character_get_price_belief_sell(owner, commodity);
+	auto price_shop_buy = game.data.character_get_price_belief_buy(owner, commodity);
+
+	// the best prices are served first, ties go to the older character
+	std::sort(book.bids.begin(), book.bids.end(), [](order const& a, order const& b) {
+		if (a.price != b.price) {
+			return a.price > b.price;
+		}
+		return a.trader.index() < b.trader.index();
+	});
+	std::sort(book.asks.begin(), book.asks.end(), [](order const& a, order const& b) {
+		if (a.price != b.price) {
+			return a.price < b.price;
+		}
+		return a.trader.index() < b.trader.index();
+	});
+
+	for (auto& bid : book.bids) {
+		if (bid.price < price_shop_sell) {
+			break;
+		}
+		for (int unit = 0; unit < bid.quantity; unit++) {
+			auto in_stock = game.data.character_get_inventory(owner, commodity);
+			auto coins = game.data.character_get_inventory(bid.trader, game.coins);
+			if (in_stock >= 1.f && coins >= price_shop_sell) {
+				log_event(game, events::event_type::buy, bid.trader, owner, commodity, price_shop_sell);
+				transaction(game, owner, bid.trader, commodity, 1.f);
+				transaction(game, bid.trader, owner, game.coins, price_shop_sell);
+			} else if (coins >= price_shop_sell) {
+				log_event(game, events::event_type::order, bid.trader, owner, commodity, price_shop_sell);
+				delayed_transaction(game, owner, bid.trader, commodity, 1.f);
+				transaction(game, bid.trader, owner, game.coins, price_shop_sell);
+			} else if (in_stock >= 1.f) {
+				log_event(game, events::event_type::buy_on_loan, bid.trader, owner, commodity, price_shop_sell);
+				transaction(game, owner, bid.trader, commodity, 1.f);
+				delayed_transaction(game, bid.trader, owner, game.coins, price_shop_sell);
+			} else {
+				break;
+			}
+		}
+	}
+
+	for (auto& ask : book.asks) {
+		if (ask.price > price_shop_buy) {
+			break;
+		}
+		for (int unit = 0; unit < ask.quantity; unit++) {
+			if (game.data.character_get_inventory(owner, commodity) >= spoilage_threshold) {
+				return;
+			}
+			auto coins_shop = game.data.character_get_inventory(owner, game.coins);
+			if (coins_shop >= price_shop_buy) {
+				log_event(game, events::event_type::sell, ask.trader, owner, commodity, price_shop_buy);
+				transaction(game, ask.trader, owner, commodity, 1.f);
+				transaction(game, owner, ask.trader, game.coins, price_shop_buy);
+			} else {
+				log_event(game, events::event_type::sell_on_promise, ask.trader, owner, commodity, price_shop_buy);
+				transaction(game, ask.trader, owner, commodity, 1.f);
+				delayed_transaction(game, owner, ask.trader, game.coins, price_shop_buy);
+			}
+		}
+	}
+}
+
+// beliefs of everyone who visited the market drift towards the prices of the shop
+void converge_beliefs(state& game, dcon::character_id cid) {
+	auto body = game.data.character_get_body_from_embodiment(cid);
+	// same drift as the three rounds of the old trade loop
+	auto alpha = 1.f - std::pow(1.f - 0.01f, (float)TRADE_UNITS_PER_TICK);
+
+	game.data.for_each_commodity([&](auto commodity) {
+		if (commodity == game.coins) {
+			return;
+		}
+		if (commodity == game.weapon_service) {
+			return;
+		}
+
+		auto shop = market_of(game, cid, body, commodity);
+		if (!shop) {
+			return;
+		}
+		auto shop_owner = game.data.building_get_owner_from_ownership(shop);
+
+		auto price_shop_sell = game.data.character_get_price_belief_sell(shop_owner, commodity);
+		auto price_shop_buy = game.data.character_get_price_belief_buy(shop_owner, commodity);
+		{
+			auto desired_price_buy = game.data.character_get_price_belief_buy(cid, commodity);
+			auto shift = price_shop_sell - desired_price_buy;
+			game.data.character_set_price_belief_buy(cid, commodity, desired_price_buy + shift * alpha);
+		}
+		{
+			auto desired_price_sell = game.data.character_get_price_belief_sell(cid, commodity);
+			auto shift = price_shop_buy - desired_price_sell;
+			game.data.character_set_price_belief_sell(cid, commodity, desired_price_sell + shift * alpha);
+		}
+	});
+}
+
+}
+
+namespace phases {
+
+void characters_ai(state& game) {
+	if (!game.parallel_ai) {
+		// decisions are applied right away, so every character sees the changes made by previous ones
+		auto& buffer = game.ai_buffers.empty() ? game.ai_buffers.emplace_back() : game.ai_buffers[0];
+		game.data.for_each_character([&](auto cid) {
+			ai::update::character(game, buffer, cid);
+			ai::apply(game, buffer);
+		});
+		return;
+	}
+
+	// batches decide against the state at the start of the phase,
+	// applying them in character order validates each decision against what was applied before it
+	jobs::start(game.workers);
+
+	size_t size = game.data.character_size();
+	auto batches = (size + AI_BATCH_SIZE - 1) / AI_BATCH_SIZE;
+	if (game.ai_buffers.size() < batches) {
+		game.ai_buffers.resize(batches);
+	}
+
+	jobs::run_batches(game.workers, batches, [&](size_t batch) {
+		auto& buffer = game.ai_buffers[batch];
+		auto end = std::min(size, (batch + 1) * AI_BATCH_SIZE);
+		for (auto i = batch * AI_BATCH_SIZE; i < end; i++) {
+			dcon::character_id cid {dcon::character_id::value_base_t(i)};
+			if (!game.data.character_is_valid(cid)) {
+				continue;
+			}
+			ai::update::character(game, buffer, cid);
+			ai::end_decision(buffer, cid);
+		}
+	});
+
+	ai::begin_tracking(game);
+	for (size_t batch = 0; batch < batches; batch++) {
+		ai::apply_decisions(game, game.ai_buffers[batch]);
+	}
+	ai::end_tracking(game);
+}
+
+void hunger(state& game) {
+	game.data.for_each_thing([&](auto id) {
+		auto kind = game.data.thing_get_kind(id);
+		if (!game.data.kind_get_preserved_after_death(kind)) {
+			auto hunger = game.data.thing_get_hunger(id);
+			game.data.thing_set_hunger(id, hunger + 1);
+			if (game.data.thing_get_hunger(id) > 10000) {
+				spatial_remove(game.grid, id);
+				game.data.delete_thing(id);
+			}
+		}
+	});
+}
+
+void trade(state& game) {
+	// trade:
+
+	// ai logic would be very simple:
+	// sell things you don't desire yourself
+	// buy things you desire and miss
+
+	// currently we can buy things only from the favourite shop:
+
+	size_t keys = game.data.building_size() * game.data.commodity_size();
+	if (game.market.book_index.size() != keys) {
+		game.market.book_index.assign(keys, -1);
+	}
+
+	auto& traders = game.market.traders;
+	traders.clear();
+	game.data.for_each_character([&](auto cid) {
+		if (market::post_orders(game, cid)) {
+			traders.push_back(cid);
+		}
+	});
+
+	for (size_t i = 0; i < game.market.books_count; i++) {
+		market::clear(game, game.market.books[i]);
+	}
+
+	for (auto cid : traders) {
+		market::converge_beliefs(game, cid);
+	}
+
+	market::close_books(game);
+}
+
+void promises(state& game) {
+	// fulfill promises:
+	game.data.for_each_delayed_transaction([&](auto delayed) {
+		auto A = game.data.delayed_transaction_get_members(delayed, 0);
+		auto B = game.data.delayed_transaction_get_members(delayed, 1);
+
+		game.data.for_each_commodity([&](auto commodity) {
+			auto debt = game.data.delayed_transaction_get_balance(delayed, commodity);
+			if (debt > 0) {
+				auto inv = game.data.character_get_inventory(A, commodity);
+				if (inv >= 1) {
+					transaction(game, A, B, commodity, 1.f);
+					delayed_transaction(game, A, B, commodity, -1.f);
+				}
+			} else if (debt < 0) {
+				auto inv = game.data.character_get_inventory(B, commodity);
+				if (inv >= 1) {
+					transaction(game, B, A, commodity, 1.f);
+					delayed_transaction(game, B, A, commodity, -1.f);
+				}
+			}
+		});
+	});
+}
+
+void eating(state& game) {
+	game.data.for_each_character([&](auto cid) {
+		auto body = game.data.character_get_body_from_embodiment(cid);
+		if (game.data.thing_get_hunger(body) > BASE_FOOD_NUTRITION * 1.5f) {
+			eat(game, cid);
+		}
+		drink_potion(game, cid);
+	});
+}
+
+void prices(state& game) {
+	// event: if commodity is not selling well: reduce sell price:
+	game.price_update_tick++;
+	if (game.price_update_tick > 4) {
+		game.price_update_tick = 0;
+	}
+	if (game.price_update_tick  == 0) {
+		game.data.for_each_character([&](auto cid) {
+			if (game.data.character_get_ai_type(cid) == game.personality.weapon_master) {
+				auto cost = game.data.character_get_price_belief_sell(cid, game.weapon_service);
+				game.data.character_set_price_belief_sell(cid, game.weapon_service, cost * 0.99f);
+			}
+			game.data.for_each_commodity([&](auto commodity) {
+				if (commodity == game.coins) {
+					return;
+				}
+				if (commodity == game.weapon_service) {
+					return;
+				}
+
+				auto inventory = game.data.character_get_inventory(cid, commodity);
+				auto ai = game.data.character_get_ai_type(cid);
+				auto target = game.data.ai_model_get_stockpile_target(ai, commodity);
+
+				auto spoilage = (float)(int)(inventory / spoilage_threshold);
+
+				if (inventory > target * 2) {
+					auto price_decay_sell = std::exp(-inventory / target * 0.05f);
+					auto price_decay_buy = std::exp(-inventory / target * 0.1f);
+
+					auto price_shop_sell = game.data.character_get_price_belief_sell(cid, commodity);
+					game.data.character_set_price_belief_sell(cid, commodity, std::max(0.00001f,  price_shop_sell * price_decay_sell));
+
+					auto price_shop_buy = game.data.character_get_price_belief_buy(cid, commodity);
+					game.data.character_set_price_belief_buy(cid, commodity, std::max(0.00001f, price_shop_buy * price_decay_buy));
+				}
+
+				// if something is spoiling, we want to get rid of it
+				if (spoilage > 0) {
+					auto price_decay_sell = std::exp(-spoilage * 0.05f);
+					auto price_decay_buy = std::exp(-spoilage * 0.1f);
+					// spoilage
+					game.data.character_set_inventory(cid, commodity, inventory - (float)(int)(inventory / 20));
+
+					auto price_shop_sell = game.data.character_get_price_belief_sell(cid, commodity);
+					game.data.character_set_price_belief_sell(cid, commodity, 0.00001f + price_shop_sell * price_decay_sell);
+
+					auto price_shop_buy = game.data.character_get_price_belief_buy(cid, commodity);
+					game.data.character_set_price_belief_buy(cid, commodity, 0.00001f + price_shop_buy * price_decay_buy);
+				}
+
+				auto coins = game.data.character_get_inventory(cid, game.coins);
+
+				if (inventory < target) {
+					auto lack = (float)(target - inventory) / (float)target;
+					auto mult_buy = std::exp(lack  * 0.05f);
+
+					auto price_shop_buy = game.data.character_get_price_belief_buy(cid, commodity);
+					game.data.character_set_price_belief_buy(cid, commodity, std::min(coins + 10.f,  price_shop_buy * mult_buy));
+					auto price_shop_sell = game.data.character_get_price_belief_sell(cid, commodity);
+
+					if (game.data.character_get_ai_type(cid) == game.personality.shopkeeper) {
+						game.data.character_set_price_belief_sell(cid, commodity,  price_shop_buy * mult_buy);
+					} else {
+						game.data.character_set_price_belief_sell(cid, commodity, std::min(coins + 10.f,  price_shop_sell * mult_buy));
+					}
+				}
+			});
+		});
+	}
+}
+
+void movement(state& game) {
+	game.data.execute_parallel_over_thing([&](auto critter){
+		auto kind = game.data.thing_get_kind(critter);
+		auto speed = game.data.kind_get_speed(kind);
+
+		auto soul = game.data.thing_get_embodier_from_embodiment(critter);
+		auto following = game.data.thing_get_follow_target_as_follower(critter);
+		auto target = game.data.follow_target_get_followed(following);
+		auto x = game.data.thing_get_x(critter);
+		auto y = game.data.thing_get_y(critter);
+
+		auto cx = ve::select(target == dcon::thing_id{}, x, game.data.thing_get_x(target));
+		auto cy = ve::select(target == dcon::thing_id{}, y, game.data.thing_get_y(target));
+
+		auto alpha = game.data.thing_get_direction(critter);
+		auto dx = ve::apply([&](float alpha_v){return std::sin(alpha_v);}, alpha);
+		auto dy = ve::apply([&](float alpha_v){return -std::cos(alpha_v);}, alpha);
+
+		auto fdx = cx - x;
+		auto fdy = cy - y;
+
+		auto fn = ve::sqrt(fdx * fdx + fdy * fdy);
+
+		fdx = ve::select(fn > speed, fdx / fn, fdx) * 0.05f;
+		fdy = ve::select(fn > speed, fdy / fn, fdy) * 0.05f;
+
+		dx = ve::select(soul == dcon::character_id{}, dx * 0.05f, 0.f);
+		dy = ve::select(soul == dcon::character_id{}, dy * 0.05f, 0.f);
+		game.data.thing_set_x(critter, x + (dx + fdx) * speed);
+		game.data.thing_set_y(critter, y + (dy + fdy) * speed);
+	});
+}
+
+void critters(state& game) {
+	// draws are keyed by the thing, so results do not depend on the order of lanes
+	auto wander_key = counter_rng::make_key(game.seed, counter_rng::stream::wander);
+	auto birth_key = counter_rng::make_key(game.seed, counter_rng::stream::birth);
+	auto regrowth_key = counter_rng::make_key(game.seed, counter_rng::stream::regrowth);
+
+	auto meatbug = game.special_kinds.meatbug;
+	auto queen = game.special_kinds.meatbug_queen;
+	auto meatflower = game.special_kinds.meatflower;
+
+	game.data.execute_parallel_over_thing([&](auto critter){
+		auto kind = game.data.thing_get_kind(critter);
+
+		// things which never move keep their direction: static props are cached by the renderer
+		auto soul = game.data.thing_get_embodier_from_embodiment(critter);
+		auto wanders = (soul == dcon::character_id{}) & (game.data.kind_get_speed(kind) > 0.f);
+		auto alpha = game.data.thing_get_direction(critter);
+		auto jitter = counter_rng::uniform(wander_key, game.tick, critter);
+		game.data.thing_set_direction(critter, ve::select(wanders, alpha + 0.1f * jitter - 0.05f, alpha));
+
+		auto hp = game.data.thing_get_hp(critter);
+		auto hp_max = game.data.thing_get_hp_max(critter);
+		auto regrows = (kind == meatflower) & (counter_rng::uniform(regrowth_key, game.tick, critter) < 0.05f);
+		game.data.thing_set_hp(critter, ve::select(regrows, ve::select(hp < hp_max, hp + 1, hp_max), hp));
+	});
+
+	// rolls are vectorized, the few things which pass them are compacted in thing order
+	game.will_give_birth.clear();
+	game.hungry_critters.clear();
+	game.data.execute_serial_over_thing([&](auto critter){
+		auto kind = game.data.thing_get_kind(critter);
+		auto hunger = game.data.thing_get_hunger(critter);
+		auto is_queen = kind == queen;
+		auto gives_birth =
+			is_queen
+			& (hunger < 1000.f)
+			& (counter_rng::uniform(birth_key, game.tick, critter) < 0.01f);
+		auto hunts = (is_queen | (kind == meatbug)) & (hunger > 500.f);
+		ve::apply([&](dcon::thing_id id, bool birth, bool hungry) {
+			if (birth) {
+				game.will_give_birth.push_back(id);
+			}
+			if (hungry) {
+				game.hungry_critters.push_back(id);
+			}
+			return birth || hungry;
+		}, critter, gives_birth, hunts);
+	});
+
+	auto& buffer = game.ai_buffers.empty() ? game.ai_buffers.emplace_back() : game.ai_buffers[0];
+	for (auto critter : game.hungry_critters) {
+		// an earlier hunt could have killed it
+		if (!game.data.thing_is_valid(critter)) {
+			continue;
+		}
+		ai::update::meatbug(game, buffer, critter);
+		ai::apply(game, buffer);
+	}
+}
+
+void births(state& game) {
+	for (auto& mother : game.will_give_birth) {
+		auto child = game.data.create_thing();
+		game.data.thing_set_kind(child, game.special_kinds.meatbug);
+		game.data.thing_set_hp(child, 30);
+		game.data.thing_set_hp_max(child, 30);
+		game.data.thing_set_x(child, game.data.thing_get_x(mother));
+		game.data.thing_set_y(child, game.data.thing_get_y(mother));
+		spatial_sync(game, child);
+		game.data.force_create_follow_target(child, mother);
+	}
+}
+
+}
+
+void update(state& game) {
+	profiler::scope tick_timer {game.profile, profiler::phase::tick};
+
+	{
+		profiler::scope timer {game.profile, profiler::phase::characters_ai};
+		phases::characters_ai(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::hunger};
+		phases::hunger(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::trade};
+		phases::trade(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::promises};
+		phases::promises(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::eating};
+		phases::eating(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::prices};
+		phases::prices(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::movement};
+		phases::movement(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::spatial_grid};
+		spatial_update(game);
+	}
+
+	{
+		profiler::scope timer {game.profile, profiler::phase::critters};
+		phases::critters(game);
+	}
+	{
+		profiler::scope timer {game.profile, profiler::phase::births};
+		phases::births(game);
+	}
+
+	game.tick++;
+}
+}
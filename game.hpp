@@ -0,0 +1,467 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "data_ids.hpp"
+#include "data.hpp"
+
+#include "events.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+// simulation only: nothing here knows about windows or opengl
+
+namespace game {
+
+struct skill_ids {
+	dcon::skill_id cooking;
+};
+
+struct ai_state {
+	dcon::activity_id weapon_repair;
+	dcon::activity_id shopping;
+	dcon::activity_id getting_food;
+	dcon::activity_id prepare_food;
+	dcon::activity_id working;
+};
+
+struct ai_personality {
+	dcon::ai_model_id hunter;
+	dcon::ai_model_id alchemist;
+	dcon::ai_model_id weapon_master;
+	dcon::ai_model_id herbalist;
+	dcon::ai_model_id innkeeper;
+	dcon::ai_model_id shopkeeper;
+};
+
+constexpr inline float BASE_FOOD_NUTRITION = 2000.f;
+
+constexpr int CHUNK_SIZE = 32;
+constexpr int CHUNK_AREA = CHUNK_SIZE * CHUNK_SIZE;
+
+constexpr int WORLD_RADIUS = 16;
+constexpr int WORLD_SIZE = WORLD_RADIUS * 2;
+constexpr int WORLD_AREA = WORLD_SIZE * WORLD_SIZE;
+
+constexpr int WORLD_SIZE_TILES = CHUNK_SIZE * WORLD_SIZE;
+constexpr int WORLD_AREA_TILES = WORLD_SIZE_TILES * WORLD_SIZE_TILES;
+
+constexpr int spoilage_threshold = 30;
+
+constexpr int chunk_index(int chunk_x, int chunk_y) {
+	return (chunk_x + WORLD_RADIUS) * WORLD_SIZE + (chunk_y + WORLD_RADIUS);
+}
+
+struct map_state {
+	// page aligned like the container, see state
+	alignas(4096) std::array<char, WORLD_AREA_TILES> height {};
+
+	// chunks which need a new mesh, in the order they were changed
+	std::array<bool, WORLD_AREA> dirty {};
+	std::deque<int> dirty_chunks;
+};
+char get_height(map_state& data, int x, int y);
+// marks the chunk of the tile as dirty, and the neighbouring chunk when the tile is on its edge
+void set_height(map_state& data, int x, int y, char value);
+void mark_dirty(map_state& data, int chunk_x, int chunk_y);
+// returns false when nothing is dirty
+bool pop_dirty_chunk(map_state& data, int& chunk_x, int& chunk_y);
+void clear_dirty_chunks(map_state& data);
+
+// uniform grid over the tile world for proximity queries
+// each chunk is split into 8x8 cells
+constexpr int SPATIAL_CELL_SIZE = CHUNK_SIZE / 8;
+constexpr int SPATIAL_GRID_SIZE = WORLD_SIZE_TILES / SPATIAL_CELL_SIZE;
+constexpr int SPATIAL_GRID_AREA = SPATIAL_GRID_SIZE * SPATIAL_GRID_SIZE;
+
+// cells are intrusive linked lists of things
+// zero initialised grid is a valid empty grid
+struct spatial_grid {
+	std::array<dcon::thing_id, SPATIAL_GRID_AREA> head {};
+	std::vector<dcon::thing_id> next;
+	std::vector<dcon::thing_id> prev;
+	// cell index + 1 for tracked things, zero otherwise
+	std::vector<int32_t> cell;
+
+	// bounds of occupied cells, used to stop ring searches early
+	int min_cx = SPATIAL_GRID_SIZE;
+	int min_cy = SPATIAL_GRID_SIZE;
+	int max_cx = -1;
+	int max_cy = -1;
+};
+
+int spatial_cell_coord(float x);
+void spatial_remove(spatial_grid& grid, dcon::thing_id id);
+void spatial_move(spatial_grid& grid, dcon::thing_id id, float x, float y);
+
+struct kinds {
+	dcon::kind_id human;
+	dcon::kind_id potion_flower;
+	dcon::kind_id meatbug_queen;
+	dcon::kind_id meatbug;
+	dcon::kind_id tree;
+	dcon::kind_id meatflower;
+};
+
+namespace ai {
+
+// decisions of characters are recorded and applied later,
+// so they can be made in parallel against a read only state
+enum class command_type : uint8_t {
+	set_action_type,
+	set_action_timer,
+	change_inventory,
+	transaction,
+	scale_price_belief_sell,
+	change_weapon_quality,
+	move,
+	enter,
+	leave,
+	set_hunt_target,
+	attack,
+	set_hunger,
+	log_event
+};
+
+struct command {
+	command_type type;
+	dcon::character_id character;
+	dcon::character_id other;
+	dcon::thing_id thing;
+	dcon::thing_id target;
+	dcon::building_id building;
+	dcon::commodity_id commodity;
+	dcon::activity_id activity;
+	float value;
+	float x;
+	float y;
+	events::event_type event;
+};
+
+// what a decision looked at besides static data
+// a decision made ahead of time is kept only when none of it was written
+// by the decisions applied before it, otherwise it is made again
+enum class read_type : uint8_t {
+	character,
+	thing,
+	cells
+};
+
+struct read {
+	read_type type;
+	int32_t index;
+	// inclusive rectangle of spatial grid cells
+	int32_t min_cx;
+	int32_t min_cy;
+	int32_t max_cx;
+	int32_t max_cy;
+};
+
+// ends of the commands and reads of one character in the buffer
+struct decision {
+	dcon::character_id character;
+	uint32_t commands_end;
+	uint32_t reads_end;
+};
+
+struct commands {
+	std::vector<command> list;
+	std::vector<read> reads;
+	std::vector<decision> decisions;
+};
+
+// epoch in which characters, things and grid cells were last written while applying decisions
+struct write_marks {
+	bool tracking = false;
+	uint32_t epoch = 0;
+	std::vector<uint32_t> characters;
+	std::vector<uint32_t> things;
+	std::vector<uint32_t> cells;
+	// cells written in the current epoch
+	std::vector<int32_t> dirty_cells;
+	// decisions of the last tick which had to be made again
+	size_t redecided = 0;
+};
+
+}
+
+constexpr size_t AI_BATCH_SIZE = 64;
+
+// every shop runs a book per commodity with its owner as the market maker:
+// guests post bids and asks, books are cleared once per tick
+constexpr int TRADE_UNITS_PER_TICK = 3;
+
+struct order {
+	dcon::character_id trader;
+	float price;
+	int quantity;
+};
+
+struct order_book {
+	dcon::building_id building;
+	dcon::commodity_id commodity;
+	dcon::character_id owner;
+	std::vector<order> bids;
+	std::vector<order> asks;
+};
+
+struct market_state {
+	// books are reused between ticks, only the first books_count are open
+	std::vector<order_book> books;
+	size_t books_count = 0;
+	// building * commodities count + commodity -> open book or -1
+	std::vector<int32_t> book_index;
+	// characters which posted into at least one book this tick
+	std::vector<dcon::character_id> traders;
+};
+
+struct state {
+	// page aligned: its columns then start at the same offset within a page in every process,
+	// which lets world images map file pages straight onto them
+	alignas(4096) dcon::data_container data;
+	uint32_t time;
+
+
+	dcon::commodity_id potion;
+	dcon::commodity_id coins;
+	dcon::commodity_id potion_material;
+	dcon::commodity_id raw_food;
+	dcon::commodity_id prepared_food;
+	dcon::commodity_id weapon_service;
+
+
+	dcon::building_model_id inn;
+	dcon::building_model_id shop;
+	dcon::building_model_id shop_weapon;
+
+	skill_ids skills;
+	ai_state ai;
+	ai_personality personality;
+	kinds special_kinds;
+
+	int price_update_tick = 0;
+
+	map_state map;
+	spatial_grid grid;
+	market_state market;
+
+	profiler::state profile;
+
+	// ticks since the start, stamps events
+	uint32_t tick = 0;
+	events::log events;
+
+	// decide in parallel, apply serially in character order
+	bool parallel_ai = false;
+	jobs::pool workers;
+	std::vector<ai::commands> ai_buffers;
+	ai::commands ai_retry;
+	ai::write_marks ai_marks;
+
+	// filled by the critters phase every tick, kept to reuse their storage
+	std::vector<dcon::thing_id> will_give_birth;
+	std::vector<dcon::thing_id> hungry_critters;
+
+	// draws during ticks come from counter_rng keyed by this seed,
+	// the sequential engine below is only used to generate the world
+	uint64_t seed = 0x5eed;
+	std::default_random_engine rng {};
+	std::uniform_real_distribution<float> uniform{0.0, 1.0};
+	std::normal_distribution<float> normal {0.f, 1.f};
+};
+
+// keeps the grid exact: call it whenever a position is written outside of the movement pass
+void spatial_sync(state& game, dcon::thing_id id);
+// full pass after the vectorized movement, which writes positions in bulk
+void spatial_update(state& game);
+
+inline auto spatial_filter_kind(state& game, dcon::kind_id kind) {
+	return [&game, kind](dcon::thing_id candidate) {
+		return game.data.thing_get_kind(candidate) == kind;
+	};
+}
+
+// calls f(thing, squared distance) for every thing strictly inside the radius which passes the filter
+template<typename FILTER, typename F>
+void spatial_for_each_in_radius(state& game, float x, float y, float radius, FILTER&& filter, F&& f) {
+	auto& grid = game.grid;
+	auto min_cx = std::max(spatial_cell_coord(x - radius), grid.min_cx);
+	auto max_cx = std::min(spatial_cell_coord(x + radius), grid.max_cx);
+	auto min_cy = std::max(spatial_cell_coord(y - radius), grid.min_cy);
+	auto max_cy = std::min(spatial_cell_coord(y + radius), grid.max_cy);
+	auto radius_2 = radius * radius;
+
+	for (int cx = min_cx; cx <= max_cx; cx++) {
+		for (int cy = min_cy; cy <= max_cy; cy++) {
+			for (
+				auto candidate = grid.head[cx * SPATIAL_GRID_SIZE + cy];
+				candidate;
+				candidate = grid.next[candidate.index()]
+			) {
+				auto tx = game.data.thing_get_x(candidate);
+				auto ty = game.data.thing_get_y(candidate);
+				auto d = (tx - x) * (tx - x) + (ty - y) * (ty - y);
+				if (d < radius_2 && filter(candidate)) {
+					f(candidate, d);
+				}
+			}
+		}
+	}
+}
+
+// world generation engine and distributions, stored as text:
+// the standard library gives no portable binary form of their state
+std::string save_rng(state& game);
+bool load_rng(state& game, std::byte const* data, size_t size);
+
+// rebuilds what is never saved: the spatial grid, and meshes of every chunk
+void rebuild_derived(state& game);
+
+// visits square rings of cells around the cell of (x, y) from the inside out
+// visit(thing, squared distance) is called for every thing in the ring,
+// done(squared lower bound of distance to the next ring) decides when to stop
+template<typename VISIT, typename DONE>
+void spatial_ring_search(state& game, float x, float y, float max_radius, VISIT&& visit, DONE&& done) {
+	auto& grid = game.grid;
+	if (grid.max_cx < 0) {
+		return;
+	}
+
+	auto cx = spatial_cell_coord(x);
+	auto cy = spatial_cell_coord(y);
+
+	auto visit_cell = [&](int i, int j) {
+		if (i < grid.min_cx || i > grid.max_cx || j < grid.min_cy || j > grid.max_cy) {
+			return;
+		}
+		for (
+			auto candidate = grid.head[i * SPATIAL_GRID_SIZE + j];
+			candidate;
+			candidate = grid.next[candidate.index()]
+		) {
+			auto tx = game.data.thing_get_x(candidate);
+			auto ty = game.data.thing_get_y(candidate);
+			visit(candidate, (tx - x) * (tx - x) + (ty - y) * (ty - y));
+		}
+	};
+
+	for (int r = 0; ; r++) {
+		if (r == 0) {
+			visit_cell(cx, cy);
+		} else {
+			for (int i = cx - r; i <= cx + r; i++) {
+				if (i == cx - r || i == cx + r) {
+					for (int j = cy - r; j <= cy + r; j++) {
+						visit_cell(i, j);
+					}
+				} else {
+					visit_cell(i, cy - r);
+					visit_cell(i, cy + r);
+				}
+			}
+		}
+
+		// everything occupied was visited
+		if (
+			cx - r <= grid.min_cx && cx + r >= grid.max_cx
+			&& cy - r <= grid.min_cy && cy + r >= grid.max_cy
+		) {
+			return;
+		}
+
+		// things in the next ring are at least r cells away
+		auto lower_bound = (float)(r * SPATIAL_CELL_SIZE);
+		if (lower_bound >= max_radius) {
+			return;
+		}
+		if (done(lower_bound * lower_bound)) {
+			return;
+		}
+	}
+}
+
+// nearest thing strictly inside the radius which passes the filter
+// ties are resolved towards the lower index, like a linear scan over things would do
+template<typename FILTER>
+dcon::thing_id spatial_nearest(state& game, float x, float y, float max_radius, FILTER&& filter) {
+	dcon::thing_id result {};
+	auto best = max_radius * max_radius;
+	spatial_ring_search(game, x, y, max_radius,
+		[&](dcon::thing_id candidate, float d) {
+			if (d > best || (d == best && (!result || candidate.index() > result.index()))) {
+				return;
+			}
+			if (filter(candidate)) {
+				best = d;
+				result = candidate;
+			}
+		},
+		[&](float bound) {
+			return result && best < bound;
+		}
+	);
+	return result;
+}
+
+// up to k nearest things strictly inside the radius which pass the filter, closest first
+template<typename FILTER>
+void spatial_k_nearest(
+	state& game, float x, float y, size_t k, float max_radius, FILTER&& filter,
+	std::vector<dcon::thing_id>& result
+) {
+	result.clear();
+	if (k == 0) {
+		return;
+	}
+	std::vector<std::pair<float, dcon::thing_id>> found;
+	auto max_radius_2 = max_radius * max_radius;
+	auto worse = [](std::pair<float, dcon::thing_id> const& a, std::pair<float, dcon::thing_id> const& b) {
+		return a.first < b.first || (a.first == b.first && a.second.index() < b.second.index());
+	};
+	spatial_ring_search(game, x, y, max_radius,
+		[&](dcon::thing_id candidate, float d) {
+			if (d >= max_radius_2) {
+				return;
+			}
+			std::pair<float, dcon::thing_id> item {d, candidate};
+			if (found.size() == k && !worse(item, found.back())) {
+				return;
+			}
+			if (!filter(candidate)) {
+				return;
+			}
+			found.insert(std::upper_bound(found.begin(), found.end(), item, worse), item);
+			if (found.size() > k) {
+				found.pop_back();
+			}
+		},
+		[&](float bound) {
+			return found.size() == k && found.back().first < bound;
+		}
+	);
+	for (auto& item : found) {
+		result.push_back(item.second);
+	}
+}
+
+std::string get_name (state& game, dcon::commodity_id commodity);
+std::string get_name (state& game, dcon::activity_id activity);
+// text for an event, built only when somebody looks at it
+std::string describe(state& game, events::event const& item);
+
+// array properties indexed by commodities and skills are sized to the registered count:
+// always create them through these
+dcon::commodity_id create_commodity(state& game);
+dcon::skill_id create_skill(state& game);
+
+void init(state& game);
+void update(state& game);
+
+}
@@ -0,0 +1,175 @@
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "game.hpp"
+#include "world_image.hpp"
+
+// runs the simulation without a window
+// usage: 009_headless [--parallel-ai] [--event-log path] [--checkpoint-every ticks prefix] [--resume checkpoint]...
+//   [--world image] [--write-world image] [ticks] [chrome trace output]
+// or: 009_headless --check-parallel-ai [ticks]
+
+// every this many checkpoints one is full, the rest only store what changed
+constexpr int CHECKPOINT_FULL_EVERY = 10;
+
+game::state world {};
+
+// parallel ai has to give the same world as the serial one: compares both after every tick
+int check_parallel_ai(int ticks) {
+	auto serial = std::make_unique<game::state>();
+	auto parallel = std::make_unique<game::state>();
+	parallel->parallel_ai = true;
+	game::init(*serial);
+	game::init(*parallel);
+
+	std::vector<std::byte> image;
+	size_t redecided = 0;
+	for (int i = 0; i < ticks; i++) {
+		game::update(*serial);
+		game::update(*parallel);
+		redecided += parallel->ai_marks.redecided;
+		if (checkpoint::state_hash(*serial, image) != checkpoint::state_hash(*parallel, image)) {
+			fprintf(stderr, "parallel ai diverged from serial at tick %d\n", i);
+			return 1;
+		}
+	}
+
+	printf("parallel ai matches serial for %d ticks\n", ticks);
+	printf("decisions made again: %.3f per tick\n", ticks > 0 ? (double)redecided / ticks : 0.0);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	int ticks = 1000;
+	const char* trace_path = nullptr;
+	const char* event_log_path = nullptr;
+	int checkpoint_every = 0;
+	const char* checkpoint_prefix = nullptr;
+	std::vector<std::string> resume_paths;
+	const char* world_path = nullptr;
+	const char* write_world_path = nullptr;
+	bool check_parallel = false;
+
+	int positional = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--parallel-ai") == 0) {
+			world.parallel_ai = true;
+		} else if (strcmp(argv[i], "--check-parallel-ai") == 0) {
+			check_parallel = true;
+		} else if (strcmp(argv[i], "--event-log") == 0 && i + 1 < argc) {
+			event_log_path = argv[++i];
+		} else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 2 < argc) {
+			checkpoint_every = atoi(argv[++i]);
+			checkpoint_prefix = argv[++i];
+		} else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+			resume_paths.push_back(argv[++i]);
+		} else if (strcmp(argv[i], "--world") == 0 && i + 1 < argc) {
+			world_path = argv[++i];
+		} else if (strcmp(argv[i], "--write-world") == 0 && i + 1 < argc) {
+			write_world_path = argv[++i];
+		} else if (positional == 0) {
+			ticks = atoi(argv[i]);
+			positional++;
+		} else if (positional == 1) {
+			trace_path = argv[i];
+			positional++;
+		}
+	}
+
+	if (check_parallel) {
+		return check_parallel_ai(ticks);
+	}
+
+	if (trace_path) {
+		world.profile.record_trace = true;
+	}
+
+	auto init_start = std::chrono::steady_clock::now();
+	if (world_path) {
+		world_image::mapping image;
+		size_t mapped = 0;
+		if (!world_image::open(image, world_path) || !world_image::load(world, image, &mapped)) {
+			fprintf(stderr, "failed to load world image %s\n", world_path);
+			return 1;
+		}
+		printf("world image: %.1f MiB mapped\n", mapped / (1024.0 * 1024.0));
+	} else {
+		game::init(world);
+	}
+	if (!resume_paths.empty() && !checkpoint::load(world, resume_paths)) {
+		fprintf(stderr, "failed to resume from %s\n", resume_paths[0].c_str());
+		return 1;
+	}
+	auto init_end = std::chrono::steady_clock::now();
+
+	if (write_world_path && !world_image::write(world, write_world_path)) {
+		fprintf(stderr, "failed to write world image %s\n", write_world_path);
+		return 1;
+	}
+
+	if (event_log_path && !events::start(world.events, event_log_path)) {
+		fprintf(stderr, "failed to open event log %s\n", event_log_path);
+		return 1;
+	}
+
+	printf("init: %.3f ms\n", std::chrono::duration<double, std::milli>(init_end - init_start).count());
+
+	checkpoint::writer checkpoints;
+	int checkpoints_written = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ticks; i++) {
+		game::update(world);
+		if (checkpoint_every > 0 && (i + 1) % checkpoint_every == 0) {
+			auto path = std::string(checkpoint_prefix) + "." + std::to_string(world.tick) + ".ckpt";
+			checkpoint::save(checkpoints, world, path, checkpoints_written % CHECKPOINT_FULL_EVERY != 0);
+			checkpoints_written++;
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	if (!checkpoint::wait(checkpoints)) {
+		fprintf(stderr, "failed to write the last checkpoint\n");
+	}
+
+	events::stop(world.events);
+
+	auto total = std::chrono::duration<double, std::milli>(end - start).count();
+
+	int things = 0;
+	world.data.for_each_thing([&](auto id) {
+		things++;
+	});
+
+	printf("ticks: %d\n", ticks);
+	printf("total: %.3f ms\n", total);
+	printf("per tick: %.6f ms\n", ticks > 0 ? total / ticks : 0.0);
+	printf("things alive: %d\n", things);
+	if (checkpoints_written > 0) {
+		printf("checkpoints: %d\n", checkpoints_written);
+	}
+	if (event_log_path) {
+		printf("events dropped: %zu\n", world.events.dropped.load());
+	}
+
+	printf("%-16s %10s %10s %10s\n", "phase", "min ms", "avg ms", "p99 ms");
+	for (size_t i = 0; i < profiler::CPU_PHASES_COUNT; i++) {
+		auto what = (profiler::phase)i;
+		auto stats = profiler::get_stats(world.profile, what);
+		printf("%-16s %10.4f %10.4f %10.4f\n", profiler::get_name(what), stats.min_ms, stats.avg_ms, stats.p99_ms);
+	}
+
+	if (trace_path) {
+		if (!profiler::dump_chrome_trace(world.profile, trace_path)) {
+			fprintf(stderr, "failed to write trace to %s\n", trace_path);
+			return 1;
+		}
+	}
+
+	return 0;
+}
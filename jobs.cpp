@@ -0,0 +1,106 @@
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace jobs {
+
+pool::~pool() {
+	stop(*this);
+}
+
+void worker_loop(pool& data) {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock lock {data.mutex};
+			data.wake.wait(lock, [&]() { return data.stopping || !data.queue.empty(); });
+			if (data.queue.empty()) {
+				return;
+			}
+			task = std::move(data.queue.front());
+			data.queue.pop_front();
+		}
+		task();
+	}
+}
+
+void start(pool& data, size_t threads) {
+	if (!data.workers.empty()) {
+		return;
+	}
+	if (threads == 0) {
+		auto hardware = std::thread::hardware_concurrency();
+		threads = hardware > 1 ? hardware - 1 : 1;
+	}
+	data.stopping = false;
+	for (size_t i = 0; i < threads; i++) {
+		data.workers.emplace_back([&data]() { worker_loop(data); });
+	}
+}
+
+void stop(pool& data) {
+	{
+		std::lock_guard lock {data.mutex};
+		data.stopping = true;
+	}
+	data.wake.notify_all();
+	for (auto& worker : data.workers) {
+		worker.join();
+	}
+	data.workers.clear();
+}
+
+bool running(pool& data) {
+	return !data.workers.empty();
+}
+
+void submit(pool& data, std::function<void()> task) {
+	{
+		std::lock_guard lock {data.mutex};
+		data.queue.push_back(std::move(task));
+	}
+	data.wake.notify_one();
+}
+
+struct batch_state {
+	std::atomic<size_t> next {0};
+	std::atomic<size_t> done {0};
+	std::mutex mutex;
+	std::condition_variable finished;
+};
+
+void run_batches(pool& data, size_t batches, std::function<void(size_t)> const& f) {
+	if (batches == 0) {
+		return;
+	}
+
+	auto shared = std::make_shared<batch_state>();
+
+	auto work = [shared, batches, &f]() {
+		while (true) {
+			auto batch = shared->next.fetch_add(1);
+			if (batch >= batches) {
+				return;
+			}
+			f(batch);
+			if (shared->done.fetch_add(1) + 1 == batches) {
+				std::lock_guard lock {shared->mutex};
+				shared->finished.notify_all();
+			}
+		}
+	};
+
+	auto helpers = std::min(data.workers.size(), batches - 1);
+	for (size_t i = 0; i < helpers; i++) {
+		submit(data, work);
+	}
+
+	work();
+
+	std::unique_lock lock {shared->mutex};
+	shared->finished.wait(lock, [&]() { return shared->done.load() == batches; });
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// small persistent worker pool
+
+namespace jobs {
+
+struct pool {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> queue;
+	bool stopping = false;
+
+	~pool();
+};
+
+// zero threads means one worker per hardware thread except the calling one
+void start(pool& data, size_t threads = 0);
+void stop(pool& data);
+bool running(pool& data);
+
+void submit(pool& data, std::function<void()> task);
+
+// calls f(batch) for every batch in [0, batches) and returns when all of them are done
+// the calling thread takes batches too, so it works with a pool which was not started
+void run_batches(pool& data, size_t batches, std::function<void(size_t)> const& f);
+
+}
@@ -1,13 +1,20 @@
-#include "data_ids.hpp"
 #define GLM_FORCE_SWIZZLE
 #define GLEW_STATIC
 
+#include <algorithm>
 #include <array>
 #include <assert.h>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <stdexcept>
 
+#include <limits>
+#include <iterator>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <fstream>
@@ -28,1326 +35,1257 @@
 #include "imgui/backends/imgui_impl_glfw.h"
 #include "imgui/backends/imgui_impl_opengl3.h"
 
-#include "data.hpp"
+#include "game.hpp"
+#include "world_image.hpp"
 
 #include "frustum.hpp"
 
-namespace game {
+// everything opengl related to the simulation state is attached here
 
-struct skill_ids {
-	dcon::skill_id cooking;
-};
+namespace render {
 
-struct ai_state {
-	dcon::activity_id weapon_repair;
-	dcon::activity_id shopping;
-	dcon::activity_id getting_food;
-	dcon::activity_id prepare_food;
-	dcon::activity_id working;
+// 8 bytes: half float position and octahedral normal
+// terrain positions are relative to the chunk origin, so they stay exact in half precision
+struct vertex {
+	uint16_t position[3];
+	int8_t normal[2];
 };
 
-struct ai_personality {
-	dcon::ai_model_id hunter;
-	dcon::ai_model_id alchemist;
-	dcon::ai_model_id weapon_master;
-	dcon::ai_model_id herbalist;
-	dcon::ai_model_id innkeeper;
-	dcon::ai_model_id shopkeeper;
+struct vertex_attribute {
+	GLuint location;
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	size_t offset;
 };
 
-constexpr inline float BASE_FOOD_NUTRITION = 2000.f;
-
-constexpr int CHUNK_SIZE = 32;
-constexpr int CHUNK_AREA = CHUNK_SIZE * CHUNK_SIZE;
+// the only description of the vertex layout, matches the attributes 0 and 1 of the shaders
+constexpr std::array<vertex_attribute, 2> vertex_format {{
+	{0, 3, GL_HALF_FLOAT, GL_FALSE, offsetof(vertex, position)},
+	{1, 2, GL_BYTE, GL_TRUE, offsetof(vertex, normal)},
+}};
+
+using index = uint16_t;
+constexpr GLenum INDEX_TYPE = GL_UNSIGNED_SHORT;
+
+uint16_t to_half(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+	// tiny values are flushed to zero, huge ones become infinity
+	if (exponent <= 0) {
+		return (uint16_t)sign;
+	}
+	if (exponent >= 31) {
+		return (uint16_t)(sign | 0x7c00);
+	}
+	uint32_t result = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	// round to nearest, a carry into the exponent is still correct
+	if (mantissa & 0x1000) {
+		result++;
+	}
+	return (uint16_t)result;
+}
 
-constexpr int WORLD_RADIUS = 16;
-constexpr int WORLD_SIZE = WORLD_RADIUS * 2;
-constexpr int WORLD_AREA = WORLD_SIZE * WORLD_SIZE;
+float from_half(uint16_t value) {
+	uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+	// to_half never produces subnormals
+	uint32_t bits = sign;
+	if (exponent == 31) {
+		bits |= 0x7f800000 | (mantissa << 13);
+	} else if (exponent != 0) {
+		bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
 
-constexpr int WORLD_SIZE_TILES = CHUNK_SIZE * WORLD_SIZE;
-constexpr int WORLD_AREA_TILES = WORLD_SIZE_TILES * WORLD_SIZE_TILES;
+int8_t to_snorm8(float value) {
+	return (int8_t)std::round(std::clamp(value, -1.f, 1.f) * 127.f);
+}
 
-constexpr int spoilage_threshold = 30;
+vertex pack_vertex(glm::vec3 position, glm::vec3 normal) {
+	// octahedral projection of the normal, the lower half is folded over the diagonals
+	auto n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+	glm::vec2 e {n.x, n.y};
+	if (n.z < 0.f) {
+		e = {
+			(1.f - std::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f),
+			(1.f - std::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f)
+		};
+	}
+	return {
+		{to_half(position.x), to_half(position.y), to_half(position.z)},
+		{to_snorm8(e.x), to_snorm8(e.y)}
+	};
+}
 
-struct vertex {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 texcoord;
+struct mesh_data {
+	std::vector<vertex> vertices;
+	std::vector<index> indices;
 };
 
-struct mesh {
-	std::vector<vertex> data;
-	GLuint vao;
-	GLuint vbo;
-};
+// props are flat shaded and tiny: a linear search is enough to share equal corners
+void add_triangle(mesh_data& data, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 normal) {
+	for (auto& position : {a, b, c}) {
+		auto packed = pack_vertex(position, normal);
+		auto found = std::find_if(data.vertices.begin(), data.vertices.end(), [&](vertex const& v) {
+			return memcmp(&v, &packed, sizeof(vertex)) == 0;
+		});
+		if (found == data.vertices.end()) {
+			data.indices.push_back((index)data.vertices.size());
+			data.vertices.push_back(packed);
+		} else {
+			data.indices.push_back((index)(found - data.vertices.begin()));
+		}
+	}
+}
 
-struct map_state {
-	std::array<char, WORLD_AREA_TILES> height {};
-	std::array<mesh, WORLD_AREA> meshes {};
-};
-char get_height(map_state& data, int x, int y) {
-	auto c_x = x + WORLD_RADIUS * CHUNK_SIZE;
-	auto c_y = y + WORLD_RADIUS * CHUNK_SIZE;
-	return data.height[c_x * WORLD_SIZE_TILES + c_y];
-}
-void set_height(map_state& data, int x, int y, char value) {
-	auto c_x = x + WORLD_RADIUS * CHUNK_SIZE;
-	auto c_y = y + WORLD_RADIUS * CHUNK_SIZE;
-	data.height[c_x * WORLD_SIZE_TILES + c_y] = value;
-}
-
-struct kinds {
-	dcon::kind_id human;
-	dcon::kind_id potion_flower;
-	dcon::kind_id meatbug_queen;
-	dcon::kind_id meatbug;
-	dcon::kind_id tree;
-	dcon::kind_id meatflower;
-};
+// triangles (a, b, c) and (a, c, d)
+void add_quad(mesh_data& data, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d, glm::vec3 normal) {
+	auto base = (index)data.vertices.size();
+	data.vertices.push_back(pack_vertex(a, normal));
+	data.vertices.push_back(pack_vertex(b, normal));
+	data.vertices.push_back(pack_vertex(c, normal));
+	data.vertices.push_back(pack_vertex(d, normal));
+	for (auto i : {0, 1, 2, 0, 2, 3}) {
+		data.indices.push_back(base + i);
+	}
+}
 
-struct state {
-	dcon::data_container data;
-	uint32_t time;
+void bind_vertex_format(GLuint vbo) {
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	for (auto& attribute : vertex_format) {
+		glEnableVertexAttribArray(attribute.location);
+		glVertexAttribPointer(
+			attribute.location, attribute.size, attribute.type, attribute.normalized,
+			sizeof(vertex), reinterpret_cast<void*>(attribute.offset)
+		);
+	}
+}
 
+struct gpu_mesh {
+	GLuint vao;
+	GLuint vbo;
+	GLuint ebo;
+	uint32_t indices_count;
+	// local space, before the instance transform
+	aabb bounds;
+};
 
-	dcon::commodity_id potion;
-	dcon::commodity_id coins;
-	dcon::commodity_id potion_material;
-	dcon::commodity_id raw_food;
-	dcon::commodity_id prepared_food;
-	dcon::commodity_id weapon_service;
+gpu_mesh upload_mesh(mesh_data& data) {
+	gpu_mesh result {};
+	glGenBuffers(1, &result.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, result.vbo);
+	glBufferData(GL_ARRAY_BUFFER, data.vertices.size() * sizeof(vertex), data.vertices.data(), GL_STATIC_DRAW);
 
+	glGenVertexArrays(1, &result.vao);
+	glBindVertexArray(result.vao);
 
-	dcon::building_model_id inn;
-	dcon::building_model_id shop;
-	dcon::building_model_id shop_weapon;
+	glGenBuffers(1, &result.ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, result.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indices.size() * sizeof(index), data.indices.data(), GL_STATIC_DRAW);
 
-	skill_ids skills;
-	ai_state ai;
-	ai_personality personality;
-	kinds special_kinds;
+	bind_vertex_format(result.vbo);
 
-	int price_update_tick = 0;
+	result.indices_count = (uint32_t)data.indices.size();
 
-	map_state map;
+	result.bounds = {glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max())};
+	for (auto& v : data.vertices) {
+		glm::vec3 position {from_half(v.position[0]), from_half(v.position[1]), from_half(v.position[2])};
+		result.bounds.min = glm::min(result.bounds.min, position);
+		result.bounds.max = glm::max(result.bounds.max, position);
+	}
+	return result;
+}
 
-	std::default_random_engine rng {};
-	std::uniform_real_distribution<float> uniform{0.0, 1.0};
-	std::normal_distribution<float> normal {0.f, 1.f};
+struct free_range {
+	uint32_t offset;
+	uint32_t size;
 };
 
-std::string get_name (state& game, dcon::commodity_id commodity) {
-	if (game.potion == commodity) {
-		return "Potion";
-	} else if (game.coins == commodity) {
-		return  "Coins";
-	} else if (game.potion_material == commodity) {
-		return "Potion material";
-	} else if (game.raw_food == commodity) {
-		return  "Food ingredients";
-	} else if (game.prepared_food == commodity) {
-		return  "Food";
-	} else if (game.weapon_service == commodity) {
-		return "Weapon service";
-	}
-	return "Unknown " + std::to_string(commodity.index());
-}
-
-std::string get_name (state& game, dcon::activity_id activity) {
-	if (!activity) {
-		return "Idle";
-	}
-	if (game.ai.getting_food == activity) {
-		return "Looking for food";
-	} else if (game.ai.prepare_food == activity) {
-		return  "Preparing food";
-	} else if (game.ai.shopping == activity) {
-		return "Trading";
-	} else if (game.ai.weapon_repair == activity) {
-		return  "Repair weapon";
-	} else if (game.ai.working == activity) {
-		return  "Working";
-	}
-	return "Unknown " + std::to_string(activity.index());
-}
-
-enum class change_hp_result {
-	dead, alive
+// free list over a range of elements, sorted by offset with neighbours merged
+struct arena_allocator {
+	uint32_t capacity = 0;
+	std::vector<free_range> free;
 };
 
-change_hp_result change_hp(state& game, dcon::thing_id target, int change) {
-	auto hp  = game.data.thing_get_hp(target);
-	game.data.thing_set_hp(target, hp + change);
-	if (hp + change > 0) {
-		return change_hp_result::alive;
-	} else {
-		auto kind = game.data.thing_get_kind(target);
-		auto preserve = game.data.kind_get_preserved_after_death(kind);
-		if (!preserve) {
-			game.data.delete_thing(target);
+void arena_init(arena_allocator& arena, uint32_t capacity) {
+	arena.capacity = capacity;
+	arena.free = {{0, capacity}};
+}
+
+// first fit, returns false when no free range is large enough
+bool arena_allocate(arena_allocator& arena, uint32_t size, uint32_t& offset) {
+	for (size_t i = 0; i < arena.free.size(); i++) {
+		auto& range = arena.free[i];
+		if (range.size < size) {
+			continue;
+		}
+		offset = range.offset;
+		range.offset += size;
+		range.size -= size;
+		if (range.size == 0) {
+			arena.free.erase(arena.free.begin() + i);
 		}
-		return change_hp_result::dead;
+		return true;
 	}
+	return false;
 }
 
-void transaction(state& game, dcon::character_id A, dcon::character_id B, dcon::commodity_id C, float amount) {
-	assert(amount >= 0.f);
-	auto i_A = game.data.character_get_inventory(A, C);
-	auto i_B = game.data.character_get_inventory(B, C);
+void arena_free(arena_allocator& arena, uint32_t offset, uint32_t size) {
+	auto next = std::lower_bound(arena.free.begin(), arena.free.end(), offset, [](free_range const& range, uint32_t value) {
+		return range.offset < value;
+	});
+	auto i = (size_t)(next - arena.free.begin());
+	arena.free.insert(next, {offset, size});
 
-	assert(i_A >= amount);
-	game.data.character_set_inventory(A, C, i_A - amount);
-	game.data.character_set_inventory(B, C, i_B + amount);
-}
-void delayed_transaction(state& game, dcon::character_id A, dcon::character_id B, dcon::commodity_id C, float amount) {
-	auto delayed = game.data.get_delayed_transaction_by_transaction_pair(A, B);
-	if (delayed) {
-		auto mul = 1;
-		if (A == game.data.delayed_transaction_get_members(delayed, 1)) {
-			mul = -1;
-		}
-		auto debt = game.data.delayed_transaction_get_balance(delayed, C);
-		game.data.delayed_transaction_set_balance(delayed, C, debt + (float)mul * amount);
-	} else {
-		delayed = game.data.force_create_delayed_transaction(A, B);
-		game.data.delayed_transaction_set_balance(delayed, C, amount);
+	if (i + 1 < arena.free.size() && arena.free[i].offset + arena.free[i].size == arena.free[i + 1].offset) {
+		arena.free[i].size += arena.free[i + 1].size;
+		arena.free.erase(arena.free.begin() + i + 1);
 	}
+	if (i > 0 && arena.free[i - 1].offset + arena.free[i - 1].size == arena.free[i].offset) {
+		arena.free[i - 1].size += arena.free[i].size;
+		arena.free.erase(arena.free.begin() + i);
+	}
+}
+
+void arena_grow(arena_allocator& arena, uint32_t capacity) {
+	arena_free(arena, arena.capacity, capacity - arena.capacity);
+	arena.capacity = capacity;
 }
-enum class move_result {
-	completed, failed, in_progress
+
+// layout defined by glMultiDrawElementsIndirect
+struct draw_elements_command {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
 };
 
-move_result move_to(state& game, dcon::thing_id cid, float target_x, float target_y) {
-	auto x = game.data.thing_get_x(cid);
-	auto y = game.data.thing_get_y(cid);
-	auto dx = target_x - x;
-	auto dy = target_y - y;
-	auto distance = sqrtf(dx * dx + dy * dy);
+// all terrain chunks live in one vertex and one index buffer
+// base_instance of a draw is the chunk index, which fetches the chunk origin as an instance attribute
+struct terrain_arena {
+	GLuint vao;
+	GLuint vbo;
+	GLuint ebo;
+	GLuint origins;
+	GLuint commands;
+	arena_allocator vertices;
+	arena_allocator indices;
+	std::vector<draw_elements_command> draws;
+};
 
-	auto kind = game.data.thing_get_kind(cid);
-	auto speed = game.data.kind_get_speed(kind);
+constexpr uint32_t ARENA_INITIAL_VERTICES = 1 << 18;
+constexpr uint32_t ARENA_INITIAL_INDICES = 1 << 19;
 
-	if (distance < speed) {
-		game.data.thing_set_x(cid, target_x);
-		game.data.thing_set_y(cid, target_y);
-		return move_result::completed;
-	} else {
-		game.data.thing_set_x(cid, x + dx / distance * speed);
-		game.data.thing_set_y(cid, y + dy / distance * speed);
-		return move_result::in_progress;
-	}
-	return move_result::failed;
+void setup_terrain_vao(terrain_arena& arena) {
+	glBindVertexArray(arena.vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.ebo);
+	bind_vertex_format(arena.vbo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, arena.origins);
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4),  reinterpret_cast<void*>(0));
+	glVertexAttribDivisor(3, 1);
 }
 
+void init_terrain_arena(terrain_arena& arena) {
+	arena_init(arena.vertices, ARENA_INITIAL_VERTICES);
+	arena_init(arena.indices, ARENA_INITIAL_INDICES);
 
-move_result move_to(state& game, dcon::thing_id cid, dcon::building_id target) {
-	auto target_x = game.data.building_get_tile_x(target);
-	auto target_y = game.data.building_get_tile_y(target);
+	glGenBuffers(1, &arena.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, arena.vbo);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)arena.vertices.capacity * sizeof(vertex), nullptr, GL_DYNAMIC_DRAW);
 
-	auto guest_in = game.data.thing_get_guest_location_from_guest(cid);
+	glGenBuffers(1, &arena.ebo);
+	glBindBuffer(GL_ARRAY_BUFFER, arena.ebo);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)arena.indices.capacity * sizeof(index), nullptr, GL_DYNAMIC_DRAW);
 
-	if (guest_in == target) {
-		return move_result::completed;
-	} else if (guest_in) {
-		game.data.delete_guest(game.data.thing_get_guest(cid));
-		return move_result::in_progress;
-	} else {
-		auto result = move_to(game, cid, (float)target_x, (float)target_y);
-		if (result == move_result::completed) {
-			game.data.force_create_guest(cid, target);
-			return move_result::completed;
-		}
-		return result;
+	// x, y, scale, rotation of every chunk
+	std::vector<glm::vec4> origins(game::WORLD_AREA);
+	for (int i = 0; i < game::WORLD_AREA; i++) {
+		auto x = i / game::WORLD_SIZE - game::WORLD_RADIUS;
+		auto y = i % game::WORLD_SIZE - game::WORLD_RADIUS;
+		origins[i] = {(float)(x * game::CHUNK_SIZE), (float)(y * game::CHUNK_SIZE), 1.f, 0.f};
 	}
+	glGenBuffers(1, &arena.origins);
+	glBindBuffer(GL_ARRAY_BUFFER, arena.origins);
+	glBufferData(GL_ARRAY_BUFFER, origins.size() * sizeof(glm::vec4), origins.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &arena.commands);
+
+	glGenVertexArrays(1, &arena.vao);
+	setup_terrain_vao(arena);
 }
 
+// moves the content into a larger buffer
+void grow_buffer(GLuint& buffer, size_t old_bytes, size_t new_bytes) {
+	GLuint result;
+	glGenBuffers(1, &result);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, result);
+	glBufferData(GL_COPY_WRITE_BUFFER, new_bytes, nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_bytes);
+	glDeleteBuffers(1, &buffer);
+	buffer = result;
+}
 
-void exit_the_guested(state& game, dcon::thing_id one_which_exits) {
-	auto guest_in = game.data.thing_get_guest_location_from_guest(one_which_exits);
-	if (guest_in) {
-		auto x = game.data.building_get_tile_x(guest_in);
-		auto y = game.data.building_get_tile_y(guest_in);
-		game.data.delete_guest(game.data.thing_get_guest(one_which_exits));
-		game.data.thing_set_x(one_which_exits, (float)x);
-		game.data.thing_set_y(one_which_exits, (float)y);
+uint32_t allocate_vertices(terrain_arena& arena, uint32_t count) {
+	uint32_t offset;
+	while (!arena_allocate(arena.vertices, count, offset)) {
+		auto capacity = arena.vertices.capacity * 2;
+		grow_buffer(arena.vbo, (size_t)arena.vertices.capacity * sizeof(vertex), (size_t)capacity * sizeof(vertex));
+		arena_grow(arena.vertices, capacity);
+		setup_terrain_vao(arena);
 	}
+	return offset;
 }
 
+uint32_t allocate_indices(terrain_arena& arena, uint32_t count) {
+	uint32_t offset;
+	while (!arena_allocate(arena.indices, count, offset)) {
+		auto capacity = arena.indices.capacity * 2;
+		grow_buffer(arena.ebo, (size_t)arena.indices.capacity * sizeof(index), (size_t)capacity * sizeof(index));
+		arena_grow(arena.indices, capacity);
+		setup_terrain_vao(arena);
+	}
+	return offset;
+}
 
-enum class hunt_result {
-	moving_to_target, attacking_target, seeking_target, success
-};
+// dirty chunks sent to the workers per frame at most
+constexpr int REMESH_BUDGET = 8;
+// finished chunk meshes uploaded per frame at most
+constexpr int UPLOAD_BUDGET = 64;
 
-hunt_result hunt(state& game, dcon::thing_id hunter) {
-	exit_the_guested(game, hunter);
+// staging buffers kept around for reuse, the rest are freed
+constexpr size_t STAGING_POOL_SIZE = 32;
 
-	auto selection = game.data.thing_get_hunt_target_as_hunter(hunter);
-	auto target = game.data.hunt_target_get_hunted(selection);
-	auto x = game.data.thing_get_x(hunter);
-	auto y = game.data.thing_get_y(hunter);
+// only what drawing needs: the vertices live in the terrain arena alone
+struct mesh {
+	bool uploaded;
+	uint32_t first_vertex;
+	uint32_t vertices_count;
+	uint32_t first_index;
+	uint32_t indices_count;
+	aabb bounds;
+};
 
-	auto kind_of_the_hunter = game.data.thing_get_kind(hunter);
+constexpr int CHUNK_BORDERED_SIZE = game::CHUNK_SIZE + 2;
 
-	if (!target){
-		auto min_distance_2 = 1000.f * 1000.f;
-		game.data.for_each_thing([&](dcon::thing_id candidate){
-			auto kind_of_the_hunted = game.data.thing_get_kind(candidate);
+// copy of the heights a chunk mesh depends on: the chunk itself and a border of one tile
+// workers never touch map_state, which keeps changing on the main thread
+struct chunk_heights {
+	int chunk_x;
+	int chunk_y;
+	uint32_t generation;
+	std::array<char, CHUNK_BORDERED_SIZE * CHUNK_BORDERED_SIZE> height;
+};
 
-			auto tx = game.data.thing_get_x(candidate);
-			auto ty = game.data.thing_get_y(candidate);
+struct chunk_result {
+	int chunk_index;
+	uint32_t generation;
+	mesh_data data;
+	aabb bounds;
+};
 
-			auto d = (tx - x) * (tx - x) + (ty - y) * (ty - y);
+// per thing data of instanced draws, matches the attributes 3 and 4 of the mesh shaders
+struct instance {
+	glm::vec2 position;
+	float scale;
+	float rotation;
+	float soul;
+};
 
-			if (
-				d < min_distance_2
-				&& game.data.get_food_hierarchy_by_consumption_pair(
-					kind_of_the_hunter,
-					kind_of_the_hunted
-				)
-				&& game.data.thing_get_hp(candidate) > 0
-			) {
-				min_distance_2 = d;
-				target = candidate;
-			}
-		});
+struct kind_mesh {
+	GLuint vao;
+	GLuint dead_vao;
+	uint32_t indices_count;
+	uint32_t dead_indices_count;
+	aabb bounds;
+	aabb dead_bounds;
+	// same meshes reading the instances which survived gpu culling
+	GLuint culled_vao;
+	GLuint culled_dead_vao;
+	// rarely changing things, their shadows are cached with the terrain
+	bool is_static;
+
+	// rebuilt every frame from things which are not inside of buildings
+	GLuint instances;
+	GLuint dead_instances;
+	std::vector<instance> alive_data;
+	std::vector<instance> dead_data;
+};
 
-		if (target) {
-			game.data.force_create_hunt_target(hunter, target);
-		} else {
-			return hunt_result::seeking_target;
-		}
-	}
+// matches chunk_record of shaders/cull_chunks.comp
+struct chunk_record {
+	glm::vec4 bounds_min;
+	glm::vec4 bounds_max;
+	GLuint count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint uploaded;
+};
 
-	auto tx = game.data.thing_get_x(target);
-	auto ty = game.data.thing_get_y(target);
+// optional gpu driven path: compute shaders cull chunks and things and write the indirect commands
+// inputs change once per tick at most, the cpu never walks them per pass
+struct gpu_culling {
+	bool enabled = false;
+
+	GLuint chunks_program;
+	GLint chunks_planes_location;
+	GLint chunks_count_location;
+	GLuint things_program;
+	GLint things_planes_location;
+	GLint things_count_location;
+
+	// one record and one command per chunk
+	GLuint chunks;
+	GLuint chunk_commands;
+
+	// instances of every kind, a group is the alive or the dead things of a kind
+	GLuint instances;
+	GLuint groups;
+	GLuint group_bounds;
+	GLuint group_commands;
+	GLuint visible_instances;
+	uint32_t instances_count;
+	uint32_t instances_capacity;
+	std::vector<instance> instances_data;
+	std::vector<GLuint> groups_data;
+	std::vector<glm::vec4> group_bounds_data;
+	// instance_count is zero, written back before every dispatch
+	std::vector<draw_elements_command> group_templates;
+};
 
-	auto d = (tx - x) * (tx - x) + (ty - y) * (ty - y);
+enum class things_filter {
+	all, static_only, dynamic_only
+};
 
-	if (d < 0.2f) {
-		auto one_which_embodies = game.data.thing_get_embodier_from_embodiment(hunter);
+constexpr GLsizei SHADOW_CASCADES = 4;
+// cached shadows follow the light once it turned by this many radians
+constexpr float SHADOW_LIGHT_STEP = 0.005f;
+// casters this far towards the light from a cascade still throw shadows into it
+constexpr float SHADOW_CASTER_DISTANCE = 60.f;
+// a cascade moves in steps of this fraction of its size, so its projection stays the same for many frames
+constexpr float SHADOW_SNAP_STEPS = 8.f;
+// largest exponent whose squared moments still fit into half floats is about 5.5
+constexpr float SHADOW_EVSM_EXPONENT = 5.f;
+
+// terrain and static things are rendered into these layers only when something changes
+// every frame they are copied into the shadow map and dynamic things are drawn on top
+struct shadow_cache {
+	glm::vec3 light_direction {};
+	// bumped by terrain uploads and changes of static things
+	uint32_t static_version = 1;
+	std::vector<instance> static_instances;
+
+	GLsizei resolution;
+	// rg16f moments of exponentially warped depth instead of rg32f moments of depth
+	bool half_precision = false;
+	// owned by the render loop
+	GLuint map;
+	GLuint static_map;
+	std::array<GLuint, SHADOW_CASCADES> static_depth;
+	std::array<GLuint, SHADOW_CASCADES> static_fbo;
+	std::array<glm::mat4, SHADOW_CASCADES> projections;
+	std::array<uint32_t, SHADOW_CASCADES> versions {};
+	// cascades rendered again during the last frame
+	int refreshed = 0;
+
+	// separable prefiltering: horizontal pass into the single layer, vertical pass back into the map
+	GLuint blur_program;
+	GLint blur_source_location;
+	GLint blur_layer_location;
+	GLint blur_direction_location;
+	GLuint blurred;
+	GLuint blurred_fbo;
+	GLuint empty_vao;
+};
 
-		auto damage = 10;
+// the scene is shaded into this target, fog, tonemapping and gamma run once per pixel afterwards
+struct post_process {
+	GLuint program;
+	GLint color_location;
+	GLint depth_location;
+	GLint inverse_projection_location;
+	GLint ambient_location;
+
+	GLuint fbo;
+	GLuint color;
+	GLuint depth;
+	int width = 0;
+	int height = 0;
+	GLuint empty_vao;
+};
 
-		if (one_which_embodies) {
-			auto weapon = game.data.character_get_weapon_quality(one_which_embodies);
-			damage *= (1.f + weapon);
-			auto quality = game.data.character_get_weapon_quality(one_which_embodies);
-			game.data.character_set_weapon_quality(one_which_embodies, quality * 0.95f);
-		}
+// results are read this many frames after submission, so reading them never waits for the gpu
+constexpr size_t GPU_TIMER_FRAMES = 2;
+constexpr size_t GPU_PASSES = profiler::PHASES_COUNT - profiler::CPU_PHASES_COUNT;
+
+// GL_TIME_ELAPSED queries around the render passes of a frame
+struct gpu_timers {
+	std::array<std::array<GLuint, GPU_PASSES>, GPU_TIMER_FRAMES> queries;
+	std::array<std::array<bool, GPU_PASSES>, GPU_TIMER_FRAMES> pending {};
+	std::array<std::array<profiler::clock::time_point, GPU_PASSES>, GPU_TIMER_FRAMES> submitted;
+	std::array<std::array<profiler::pass_counters, GPU_PASSES>, GPU_TIMER_FRAMES> counters;
+	size_t frame = 0;
+
+	// filled by the draw functions, moved into the pass when it ends
+	profiler::pass_counters current {};
+	profiler::phase open_pass = profiler::phase::count;
+
+	// counters of the latest measured frame and samples lost to a slow gpu
+	std::array<profiler::pass_counters, GPU_PASSES> last {};
+	size_t dropped = 0;
+};
 
-		auto result = change_hp(game, target, -damage);
+struct state {
+	std::array<mesh, game::WORLD_AREA> meshes {};
+	terrain_arena terrain;
+	// chunks which passed culling during the last frame
+	int visible_chunks = 0;
+	int shadow_chunks = 0;
+
+	// latest requested mesh of every chunk, older results are dropped
+	std::array<uint32_t, game::WORLD_AREA> generation {};
+	int meshing_in_flight = 0;
+	std::mutex ready_mutex;
+	std::vector<chunk_result> ready;
+	// cpu side meshes waiting for the next chunk, main thread only
+	std::vector<mesh_data> staging;
+	// indexed by kind
+	std::vector<kind_mesh> kinds;
+	gpu_culling culling;
+	shadow_cache shadows;
+	post_process post;
+	gpu_timers timers;
+
+	// declared last: destroyed first, so workers finish before the results queue goes away
+	jobs::pool workers;
+};
 
-		if (result == change_hp_result::dead) {
-			if (one_which_embodies) {
-				auto food = game.data.character_get_inventory(one_which_embodies, game.raw_food);
-				game.data.character_set_inventory(one_which_embodies, game.raw_food, food + 1.f);
-			} else {
-				game.data.thing_set_hp(hunter, game.data.thing_get_hp(hunter) + 5);
-				game.data.thing_set_hunger(hunter, game.data.thing_get_hunger(hunter) - BASE_FOOD_NUTRITION);
-			}
-			game.data.delete_hunt_target(selection);
-			return hunt_result::success;
-		} else {
-			return hunt_result::attacking_target;
-		}
-	} else {
-		move_to(game, hunter, tx, ty);
-		return hunt_result::moving_to_target;
-	}
-}
-
-void repair_weapon(state& game, dcon::character_id cid, dcon::character_id master) {
-	auto timer = game.data.character_get_action_timer(cid);
-	auto weapon_repair_price = game.data.character_get_price_belief_sell(master, game.weapon_service);
-	if (timer == 0) {
-		printf("start repair\n");
-		game.data.character_set_action_timer(cid, timer + 1);
-		transaction(game, cid, master, game.coins, weapon_repair_price);
-		game.data.character_set_price_belief_sell(master, game.weapon_service, weapon_repair_price * 1.05f);
-	} else if (timer > 4) {
-		printf("complete repair\n");
-		auto quality = game.data.character_get_weapon_quality(cid);
-		game.data.character_set_weapon_quality(cid, quality + 0.3f);
-		game.data.character_set_action_timer(cid, 0.f);
-		game.data.character_set_action_type(cid, {});
-		auto body = game.data.character_get_body_from_embodiment(cid);
-		game.data.delete_guest(game.data.thing_get_guest(body));
-	} else {
-		game.data.character_set_action_timer(cid, timer + 1);
-	}
+void count_draw(state& data, uint64_t vertices) {
+	data.timers.current.draws++;
+	data.timers.current.vertices += vertices;
 }
 
-void make_potion(state& game, dcon::character_id cid) {
-	auto material = game.data.character_get_inventory(cid, game.potion_material);
-	assert(material >= 1.f);
-	auto timer = game.data.character_get_action_timer(cid);
-	if (timer > 6) {
-		auto potion = game.data.character_get_inventory(cid, game.potion);
-		game.data.character_set_inventory(cid, game.potion_material, material - 1.f);
-		game.data.character_set_inventory(cid, game.potion, potion + 1.f);
-		game.data.character_set_action_timer(cid, 0);
-		game.data.character_set_action_type(cid, {});
-	} else {
-		game.data.character_set_action_timer(cid, timer + 1);
-	}
+void count_state_changes(state& data, uint32_t changes = 1) {
+	data.timers.current.state_changes += changes;
 }
 
-void increase_hp(state& game, dcon::thing_id target, int value) {
-	auto hp = game.data.thing_get_hp(target);
-	auto hp_max = game.data.thing_get_hp_max(target);
-	game.data.thing_set_hp(target, std::min(hp_max, hp + value));
+size_t pass_index(profiler::phase what) {
+	return (size_t)what - profiler::CPU_PHASES_COUNT;
 }
 
-void prepare_food(state& game, dcon::character_id cid) {
-	auto material = game.data.character_get_inventory(cid, game.raw_food);
-	assert(material >= 1.f);
-	auto timer = game.data.character_get_action_timer(cid);
-	if (timer > 1) {
-		auto result = game.data.character_get_inventory(cid, game.prepared_food);
-		// auto skill = game.data.character_get_skills(cid, )
-		auto skill_bonus = (float)(int)(game.data.character_get_skills(cid, game.skills.cooking) / 0.3);
-		game.data.character_set_inventory(cid, game.raw_food, material - 1.f);
-		game.data.character_set_inventory(cid, game.prepared_food, result + 1.f + skill_bonus);
-		game.data.character_set_action_timer(cid, 0);
-		game.data.character_set_action_type(cid, {});
-	} else {
-		game.data.character_set_action_timer(cid, timer + 1);
-	}
-}
-void gather_potion_material(state& game, dcon::character_id cid) {
-	auto timer = game.data.character_get_action_timer(cid);
-	if (timer > 3) {
-		auto count = game.data.character_get_inventory(cid, game.potion_material);
-		game.data.character_set_inventory(cid, game.potion_material, count + 1.f);
-		game.data.character_set_action_timer(cid, 0);
-		game.data.character_set_action_type(cid, {});
-	} else {
-		game.data.character_set_action_timer(cid, timer + 1);
+void init_gpu_timers(gpu_timers& timers) {
+	for (auto& frame : timers.queries) {
+		glGenQueries((GLsizei)frame.size(), frame.data());
 	}
 }
 
-void eat(state& game, dcon::character_id cid) {
-	auto food = game.data.character_get_inventory(cid, game.prepared_food);
-	auto body = game.data.character_get_body_from_embodiment(cid);
-	auto hunger = game.data.thing_get_hunger(body);
-	if (food >= 1.f) {
-		game.data.character_set_inventory(cid, game.prepared_food, food - 1);
-		game.data.thing_set_hunger(body, hunger - BASE_FOOD_NUTRITION);
-		increase_hp(game, body, 10);
-	}
-}
-void drink_potion(state& game, dcon::character_id cid) {
-	auto potions = game.data.character_get_inventory(cid, game.potion);
-	auto body = game.data.character_get_body_from_embodiment(cid);
-	auto hp = game.data.thing_get_hp(body);
-	auto hp_max = game.data.thing_get_hp_max(body);
-	if (hp * 2 < hp_max && potions >= 1.f) {
-		game.data.character_set_inventory(cid, game.potion, potions - 1);
-		increase_hp(game, body, 10);
-	}
+// passes must not overlap, GL_TIME_ELAPSED queries can't be nested
+void begin_pass(state& data, profiler::phase what) {
+	auto& timers = data.timers;
+	auto i = pass_index(what);
+	glBeginQuery(GL_TIME_ELAPSED, timers.queries[timers.frame][i]);
+	timers.submitted[timers.frame][i] = profiler::clock::now();
+	timers.current = {};
+	timers.open_pass = what;
 }
 
-
-
-namespace ai {
-
-void reset_action(state& game, dcon::character_id cid) {
-	game.data.character_set_action_timer(cid, 0);
-	game.data.character_set_action_type(cid, {});
+void end_pass(state& data) {
+	auto& timers = data.timers;
+	auto i = pass_index(timers.open_pass);
+	glEndQuery(GL_TIME_ELAPSED);
+	timers.counters[timers.frame][i] = timers.current;
+	timers.pending[timers.frame][i] = true;
+	timers.open_pass = profiler::phase::count;
 }
 
-namespace triggers {
+// called once per frame before any pass: moves to the oldest slot and reports what it measured
+// a result which is still not available is dropped instead of waited for
+void collect_gpu_timers(state& data, profiler::state& profile) {
+	auto& timers = data.timers;
+	timers.frame = (timers.frame + 1) % GPU_TIMER_FRAMES;
+	for (size_t i = 0; i < GPU_PASSES; i++) {
+		if (!timers.pending[timers.frame][i]) {
+			continue;
+		}
+		timers.pending[timers.frame][i] = false;
+
+		auto query = timers.queries[timers.frame][i];
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			timers.dropped++;
+			continue;
+		}
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
 
-bool desire_weapon_repair(state& game, dcon::character_id cid, dcon::character_id master) {
-	if (game.data.character_get_weapon_quality(cid) > 2.f) {
-		return false;
+		auto what = (profiler::phase)(profiler::CPU_PHASES_COUNT + i);
+		auto& counters = timers.counters[timers.frame][i];
+		profiler::record_gpu(profile, what, timers.submitted[timers.frame][i], std::chrono::nanoseconds(elapsed), counters);
+		timers.last[i] = counters;
 	}
+}
 
-	auto coins = game.data.character_get_inventory(cid, game.coins);
-	auto weapon_repair_price = game.data.character_get_price_belief_sell(master, game.weapon_service);
-	if (weapon_repair_price * 3.f > coins) {
-		return false;
+kind_mesh& get_kind_mesh(state& data, dcon::kind_id kind) {
+	auto i = (size_t)kind.index();
+	if (data.kinds.size() <= i) {
+		data.kinds.resize(i + 1);
 	}
-
-	return true;
+	return data.kinds[i];
 }
 
-bool desire_buy_food(state& game, dcon::character_id cid) {
-	auto ai_type = game.data.character_get_ai_type(cid);
-	auto food = game.data.character_get_inventory(cid, game.prepared_food);
-	auto food_target = game.data.ai_model_get_stockpile_target(ai_type,  game.prepared_food);
-	auto favourite_inn = game.data.character_get_favourite_inn(cid);
-	auto favourute_innkeeper = game.data.building_get_owner_from_ownership(favourite_inn);
-	auto coins = game.data.character_get_inventory(cid, game.coins);
-
-	auto in_stock = game.data.character_get_inventory(favourute_innkeeper, game.prepared_food);
-
-	if (food_target < food) {
-		return false;
-	}
+GLuint create_instanced_vao(gpu_mesh& mesh, GLuint instances_vbo) {
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
 
-	if (in_stock < 1.f) {
-		return false;
-	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+	bind_vertex_format(mesh.vbo);
 
-	auto food_price = game.data.character_get_price_belief_sell(favourute_innkeeper, game.prepared_food);
+	// position, scale and rotation
+	glBindBuffer(GL_ARRAY_BUFFER, instances_vbo);
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(instance),  reinterpret_cast<void*>(0));
+	glVertexAttribDivisor(3, 1);
 
-	if (food_price * 2.f > coins) {
-		return false;
-	}
+	glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(instance),  reinterpret_cast<void*>(sizeof(float) * 4));
+	glVertexAttribDivisor(4, 1);
 
-	return true;
+	return vao;
 }
 
-bool hunter_desire_shopping(state& game, dcon::character_id cid) {
-	auto ai_type = game.data.character_get_ai_type(cid);
+GLuint create_storage_buffer(size_t size, const void* content, GLenum usage) {
+	GLuint result;
+	glGenBuffers(1, &result);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, result);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, content, usage);
+	return result;
+}
 
-	auto loot  = game.data.character_get_inventory(cid, game.raw_food);
-	auto loot_target = game.data.ai_model_get_stockpile_target(ai_type, game.raw_food);
+// the programs are compiled by the caller, the buffers start empty
+void init_gpu_culling(gpu_culling& culling, GLuint chunks_program, GLuint things_program) {
+	culling.chunks_program = chunks_program;
+	culling.chunks_planes_location = glGetUniformLocation(chunks_program, "planes");
+	culling.chunks_count_location = glGetUniformLocation(chunks_program, "chunks_count");
+	culling.things_program = things_program;
+	culling.things_planes_location = glGetUniformLocation(things_program, "planes");
+	culling.things_count_location = glGetUniformLocation(things_program, "instances_count");
+
+	std::vector<chunk_record> chunks(game::WORLD_AREA);
+	culling.chunks = create_storage_buffer(chunks.size() * sizeof(chunk_record), chunks.data(), GL_DYNAMIC_DRAW);
+	culling.chunk_commands = create_storage_buffer(game::WORLD_AREA * sizeof(draw_elements_command), nullptr, GL_DYNAMIC_COPY);
+
+	culling.instances = create_storage_buffer(0, nullptr, GL_DYNAMIC_DRAW);
+	culling.groups = create_storage_buffer(0, nullptr, GL_DYNAMIC_DRAW);
+	culling.group_bounds = create_storage_buffer(0, nullptr, GL_DYNAMIC_DRAW);
+	culling.group_commands = create_storage_buffer(0, nullptr, GL_DYNAMIC_COPY);
+	culling.visible_instances = create_storage_buffer(0, nullptr, GL_DYNAMIC_COPY);
+}
 
-	auto bottom_price = game.data.character_get_price_belief_buy(cid, game.prepared_food) / 5.f;
+// kinds without a separate mesh for dead things reuse the alive one
+void set_kind_mesh(state& data, dcon::kind_id kind, gpu_mesh& mesh, gpu_mesh& dead_mesh, bool is_static = false) {
+	auto& result = get_kind_mesh(data, kind);
+	result.is_static = is_static;
+	glGenBuffers(1, &result.instances);
+	glGenBuffers(1, &result.dead_instances);
+	result.vao = create_instanced_vao(mesh, result.instances);
+	result.dead_vao = create_instanced_vao(dead_mesh, result.dead_instances);
+	result.culled_vao = create_instanced_vao(mesh, data.culling.visible_instances);
+	result.culled_dead_vao = create_instanced_vao(dead_mesh, data.culling.visible_instances);
+	result.indices_count = mesh.indices_count;
+	result.dead_indices_count = dead_mesh.indices_count;
+	result.bounds = mesh.bounds;
+	result.dead_bounds = dead_mesh.bounds;
+}
 
-	auto favourite_shop = game.data.character_get_favourite_shop(cid);
-	auto favourute_shopkeeper = game.data.building_get_owner_from_ownership(favourite_shop);
-	auto price_shop_buy = game.data.character_get_price_belief_buy(favourute_shopkeeper, game.raw_food);
+// radius of the mesh around the z axis, lowest and highest z
+glm::vec4 group_bounds(aabb const& bounds) {
+	auto x = std::max(std::abs(bounds.min.x), std::abs(bounds.max.x));
+	auto y = std::max(std::abs(bounds.min.y), std::abs(bounds.max.y));
+	return {std::sqrt(x * x + y * y), bounds.min.z, bounds.max.z, 0.f};
+}
 
-	return (loot - loot_target > 3 && price_shop_buy > bottom_price);
+void add_group(gpu_culling& culling, std::vector<instance>& instances, uint32_t indices_count, aabb const& bounds) {
+	auto group = (GLuint)culling.group_templates.size();
+	culling.group_templates.push_back({indices_count, 0, 0, 0, (GLuint)culling.instances_data.size()});
+	culling.group_bounds_data.push_back(group_bounds(bounds));
+	culling.instances_data.insert(culling.instances_data.end(), instances.begin(), instances.end());
+	culling.groups_data.insert(culling.groups_data.end(), instances.size(), group);
 }
 
-bool alchemist_desire_shopping(state& game, dcon::character_id cid) {
-	auto ai_type = game.data.character_get_ai_type(cid);
+void upload_storage(GLuint buffer, size_t size, const void* content) {
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, content);
+}
 
-	auto produced  = game.data.character_get_inventory(cid, game.potion);
-	auto produced_target = game.data.ai_model_get_stockpile_target(ai_type, game.potion);
+// groups follow the order of kinds, alive before dead, so group 2 * i + 1 is the dead things of kind i
+void upload_culling_inputs(state& data) {
+	auto& culling = data.culling;
+	culling.instances_data.clear();
+	culling.groups_data.clear();
+	culling.group_bounds_data.clear();
+	culling.group_templates.clear();
 
-	auto materials = game.data.character_get_inventory(cid, game.potion_material);
-	auto materials_target = game.data.ai_model_get_stockpile_target(ai_type, game.potion_material);
+	// kinds without meshes keep their empty groups
+	std::vector<instance> none;
+	for (auto& kind : data.kinds) {
+		add_group(culling, kind.vao == 0 ? none : kind.alive_data, kind.indices_count, kind.bounds);
+		add_group(culling, kind.vao == 0 ? none : kind.dead_data, kind.dead_indices_count, kind.dead_bounds);
+	}
 
-	auto bottom_price = game.data.character_get_price_belief_buy(cid, game.prepared_food) / 5.f;
+	culling.instances_count = (uint32_t)culling.instances_data.size();
+	upload_storage(culling.instances, culling.instances_data.size() * sizeof(instance), culling.instances_data.data());
+	upload_storage(culling.groups, culling.groups_data.size() * sizeof(GLuint), culling.groups_data.data());
+	upload_storage(culling.group_bounds, culling.group_bounds_data.size() * sizeof(glm::vec4), culling.group_bounds_data.data());
 
-	auto favourite_shop = game.data.character_get_favourite_shop(cid);
-	auto favourute_shopkeeper = game.data.building_get_owner_from_ownership(favourite_shop);
-	auto price_shop_buy = game.data.character_get_price_belief_buy(favourute_shopkeeper, game.potion);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.group_commands);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, culling.group_templates.size() * sizeof(draw_elements_command), nullptr, GL_DYNAMIC_COPY);
 
-	return (produced - produced_target > 3 && price_shop_buy > bottom_price) || materials_target > materials;
+	// the output only grows, so vertex arrays reading it stay valid
+	if (culling.instances_capacity < culling.instances_count) {
+		culling.instances_capacity = std::max(culling.instances_count, culling.instances_capacity * 2);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.visible_instances);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)culling.instances_capacity * sizeof(instance), nullptr, GL_DYNAMIC_COPY);
+	}
 }
 
+void upload_instances(GLuint vbo, std::vector<instance>& instances) {
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	// orphan the storage of the previous frame
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(instance), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(instance), instances.data());
 }
 
-namespace update {
-
-void alchemist(state& game, dcon::character_id cid) {
-	auto body = game.data.character_get_body_from_embodiment(cid);
-	auto x = game.data.thing_get_x(body);
-	auto y = game.data.thing_get_y(body);
-	auto coins = game.data.character_get_inventory(cid, game.coins);
-	auto action = game.data.character_get_action_type(cid);
-	auto ai_type = game.data.character_get_ai_type(cid);
-
-	assert(ai_type == game.personality.alchemist);
-
-	auto favourite_shop = game.data.character_get_favourite_shop(cid);
-	auto favourite_inn = game.data.character_get_favourite_inn(cid);
-
-	auto favourute_shopkeeper = game.data.building_get_owner_from_ownership(favourite_shop);
+// once per tick, for all passes of all frames until the next one
+void update_instances(state& data, game::state& game) {
+	for (auto& kind : data.kinds) {
+		kind.alive_data.clear();
+		kind.dead_data.clear();
+	}
 
-	if (!action) {
-		if (
-			ai::triggers::alchemist_desire_shopping(game, cid)
-		) {
-			game.data.character_set_action_type(cid, game.ai.shopping);
-		} else if (
-			ai::triggers::desire_buy_food(game, cid)
-		) {
-			game.data.character_set_action_type(cid, game.ai.getting_food);
+	game.data.for_each_thing([&](dcon::thing_id cid) {
+		if (game.data.thing_get_guest_location_from_guest(cid)) {
+			return;
+		}
+		auto kind = game.data.thing_get_kind(cid);
+		auto& kind_mesh = get_kind_mesh(data, kind);
+		instance item {
+			{game.data.thing_get_x(cid), game.data.thing_get_y(cid)},
+			game.data.kind_get_size(kind),
+			game.data.thing_get_direction(cid),
+			game.data.thing_get_embodier_from_embodiment(cid) ? 1.f : 0.f
+		};
+		if (game.data.thing_get_hp(cid) > 0) {
+			kind_mesh.alive_data.push_back(item);
 		} else {
-			game.data.character_set_action_type(cid, game.ai.working);
+			kind_mesh.dead_data.push_back(item);
 		}
-		action = game.data.character_get_action_type(cid);
-	}
+	});
 
-	if (action == game.ai.shopping) {
-		if (!ai::triggers::alchemist_desire_shopping(game, cid)) {
-			ai::reset_action(game, cid);
+	for (auto& kind : data.kinds) {
+		if (kind.vao == 0) {
+			continue;
 		}
-		auto move = move_to(game, body, favourite_shop);
-		return;
+		upload_instances(kind.instances, kind.alive_data);
+		upload_instances(kind.dead_instances, kind.dead_data);
 	}
-	if (action == game.ai.getting_food) {
-		if (!ai::triggers::desire_buy_food(game, cid)) {
-			ai::reset_action(game, cid);
+
+	// cached shadows are stale once a static thing moved, died or appeared
+	std::vector<instance> static_instances;
+	for (auto& kind : data.kinds) {
+		if (kind.is_static) {
+			static_instances.insert(static_instances.end(), kind.alive_data.begin(), kind.alive_data.end());
+			static_instances.insert(static_instances.end(), kind.dead_data.begin(), kind.dead_data.end());
 		}
-		auto move = move_to(game, body, favourite_inn);
-		return;
 	}
-	if (action == game.ai.working) {
-		auto potion_price = game.data.character_get_price_belief_buy(favourute_shopkeeper, game.potion);
-		auto potion_material_cost = game.data.character_get_price_belief_sell(favourute_shopkeeper, game.potion_material);
-		if (
-			game.data.character_get_inventory(cid, game.potion_material) >= 1.f
-			&& potion_price > potion_material_cost * 2.f
-		) {
-			make_potion(game, cid);
-		} else {
-			ai::reset_action(game, cid);
-		}
-		return;
+	auto& cached = data.shadows.static_instances;
+	if (
+		cached.size() != static_instances.size()
+		|| memcmp(cached.data(), static_instances.data(), cached.size() * sizeof(instance)) != 0
+	) {
+		cached = std::move(static_instances);
+		data.shadows.static_version++;
 	}
-	game.data.character_set_action_timer(cid, 0);
-}
-
-void meatbug(state& game, dcon::thing_id body) {
-	auto hunger = game.data.thing_get_hunger(body);
-	if (hunger > 500) {
-		auto result = hunt(game, body);
-		if (result == hunt_result::success) {
-			game.data.thing_set_hunger(body, hunger - 300.f);
 
-		}
+	// turning culling on uploads the inputs of the current tick once, see the stats window
+	if (data.culling.enabled) {
+		upload_culling_inputs(data);
 	}
 }
 
-void hunter(state& game, dcon::character_id cid) {
-	auto body = game.data.character_get_body_from_embodiment(cid);
-	auto x = game.data.thing_get_x(body);
-	auto y = game.data.thing_get_y(body);
-	auto coins = game.data.character_get_inventory(cid, game.coins);
-	auto action = game.data.character_get_action_type(cid);
-	auto ai_type = game.data.character_get_ai_type(cid);
-
-	assert(ai_type == game.personality.hunter);
-
-	auto favourite_weapons_shop = game.data.character_get_favourite_shop_weapons(cid);
-	auto favourite_weapons_shop_owner = game.data.building_get_owner_from_ownership(favourite_weapons_shop);
-	auto weapon_repair_price = game.data.character_get_price_belief_sell(favourite_weapons_shop_owner, game.weapon_service);
-
-	auto favourite_shop = game.data.character_get_favourite_shop(cid);
-	auto favourite_inn = game.data.character_get_favourite_inn(cid);
-
-
-
-	if (!action) {
-		if (
-			ai::triggers::hunter_desire_shopping(game, cid)
-		) {
-			game.data.character_set_action_type(cid, game.ai.shopping);
-		} else if (
-			ai::triggers::desire_weapon_repair(game, cid, favourite_weapons_shop_owner)
-		) {
-			game.data.character_set_action_type(cid, game.ai.weapon_repair);
-		} else if (
-			game.data.thing_get_hunger(body) > BASE_FOOD_NUTRITION * 3
-			&& game.data.character_get_inventory(cid, game.raw_food) >= 1.f
-		) {
-			game.data.character_set_action_type(cid, game.ai.prepare_food);
-		} else if (
-			ai::triggers::desire_buy_food(game, cid)
-		) {
-			game.data.character_set_action_type(cid, game.ai.getting_food);
-		} else {
-			game.data.character_set_action_type(cid, game.ai.working);
-		}
+bool passes(kind_mesh const& kind, things_filter filter) {
+	switch (filter) {
+		case things_filter::static_only:
+			return kind.is_static;
+		case things_filter::dynamic_only:
+			return !kind.is_static;
+		default:
+			return true;
 	}
+}
 
-	auto guest_in = game.data.thing_get_guest_location_from_guest(body);
-	auto timer = game.data.character_get_action_timer(cid);
-
-	if (action == game.ai.weapon_repair) {
-		if (
-			ai::triggers::desire_weapon_repair(game, cid, favourite_weapons_shop_owner) || timer > 0
-		) {
-			auto move = move_to(game, body, favourite_weapons_shop);
-			if (move == move_result::completed) {
-				repair_weapon(game, cid, favourite_weapons_shop_owner);
-			}
-		} else {
-			game.data.character_set_action_timer(cid, 0);
-			game.data.character_set_action_type(cid, {});
+void draw_things(state& data, things_filter filter = things_filter::all) {
+	for (auto& kind : data.kinds) {
+		if (kind.vao == 0 || !passes(kind, filter)) {
+			continue;
 		}
-		return;
-	} else if (action == game.ai.prepare_food) {
-		if (game.data.character_get_inventory(cid, game.raw_food) >= 1.f) {
-			prepare_food(game, cid);
-		} else {
-			ai::reset_action(game, cid);
-		}
-		return;
-	} else if (action == game.ai.working) {
-		auto result = hunt(game, body);
-		if (result == hunt_result::success) {
-			ai::reset_action(game, cid);
-		}
-		return;
-	} else if (action == game.ai.shopping) {
-		if (!ai::triggers::hunter_desire_shopping(game, cid)) {
-			ai::reset_action(game, cid);
+		if (!kind.alive_data.empty()) {
+			glBindVertexArray(kind.vao);
+			glDrawElementsInstanced(GL_TRIANGLES, kind.indices_count, INDEX_TYPE, nullptr, kind.alive_data.size());
+			count_state_changes(data);
+			count_draw(data, (uint64_t)kind.indices_count * kind.alive_data.size());
 		}
-		auto move = move_to(game, body, favourite_shop);
-		return;
-	} else if (action == game.ai.getting_food) {
-		if (!ai::triggers::desire_buy_food(game, cid)) {
-			ai::reset_action(game, cid);
+		if (!kind.dead_data.empty()) {
+			glBindVertexArray(kind.dead_vao);
+			glDrawElementsInstanced(GL_TRIANGLES, kind.dead_indices_count, INDEX_TYPE, nullptr, kind.dead_data.size());
+			count_state_changes(data);
+			count_draw(data, (uint64_t)kind.dead_indices_count * kind.dead_data.size());
 		}
-		auto move = move_to(game, body, favourite_inn);
-		return;
 	}
-	game.data.character_set_action_timer(cid, 0);
 }
 
+// gl clip space planes, ax + by + cz + d >= 0 inside
+std::array<glm::vec4, 6> frustum_planes(glm::mat4 const& m) {
+	auto row = [&](int i) {
+		return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+	};
+	return {
+		row(3) + row(0), row(3) - row(0),
+		row(3) + row(1), row(3) - row(1),
+		row(3) + row(2), row(3) - row(2)
+	};
 }
 
+// fills the indirect buffers for one pass, the caller binds its own program afterwards
+void cull_on_gpu(state& data, glm::mat4 const& view_projection) {
+	auto& culling = data.culling;
+	auto planes = frustum_planes(view_projection);
+
+	glUseProgram(culling.chunks_program);
+	glUniform4fv(culling.chunks_planes_location, 6, reinterpret_cast<float *>(planes.data()));
+	glUniform1ui(culling.chunks_count_location, game::WORLD_AREA);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling.chunks);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling.chunk_commands);
+	glDispatchCompute((game::WORLD_AREA + 63) / 64, 1, 1);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.group_commands);
+	glBufferSubData(
+		GL_SHADER_STORAGE_BUFFER, 0,
+		culling.group_templates.size() * sizeof(draw_elements_command), culling.group_templates.data()
+	);
 
+	if (culling.instances_count > 0) {
+		glUseProgram(culling.things_program);
+		glUniform4fv(culling.things_planes_location, 6, reinterpret_cast<float *>(planes.data()));
+		glUniform1ui(culling.things_count_location, culling.instances_count);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling.instances);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling.groups);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culling.group_bounds);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culling.group_commands);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culling.visible_instances);
+		glDispatchCompute((culling.instances_count + 63) / 64, 1, 1);
+		count_state_changes(data, 6);
+	}
+
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	count_state_changes(data, 3);
 }
 
-void init(state& game) {
-	game.data.character_resize_skills(256);
-	game.data.character_resize_price_belief_buy(256);
-	game.data.character_resize_price_belief_sell(256);
-	game.data.character_resize_inventory(256);
-	game.data.ai_model_resize_stockpile_target(256);
-	game.data.delayed_transaction_resize_balance(256);
-
-	game.ai.getting_food = game.data.create_activity();
-	game.ai.shopping = game.data.create_activity();
-	game.ai.weapon_repair = game.data.create_activity();
-	game.ai.working = game.data.create_activity();
-	game.ai.prepare_food = game.data.create_activity();
-
-	game.coins = game.data.create_commodity();
-	game.potion_material = game.data.create_commodity();
-	game.potion = game.data.create_commodity();
-	game.raw_food = game.data.create_commodity();
-	game.prepared_food = game.data.create_commodity();
-	game.weapon_service = game.data.create_commodity();
-
-	game.skills.cooking = game.data.create_skill();
-
-	game.inn = game.data.create_building_model();
-	game.shop = game.data.create_building_model();
-	game.shop_weapon = game.data.create_building_model();
-
-	game.special_kinds.human = game.data.create_kind();
-	game.data.kind_set_size(game.special_kinds.human, 1.f);
-	game.data.kind_set_speed(game.special_kinds.human, 0.03f);
-
-	auto rat = game.data.create_kind();
-	game.data.kind_set_size(rat, 0.5f);
-	game.data.kind_set_speed(rat, 0.08f);
-
-
-	game.special_kinds.meatflower = game.data.create_kind();
-	game.data.kind_set_size(game.special_kinds.meatflower, 0.1f);
-	game.data.kind_set_speed(game.special_kinds.meatflower, 0.0f);
-	game.data.kind_set_preserved_after_death(game.special_kinds.meatflower, true);
-
-	game.special_kinds.meatbug = game.data.create_kind();
-	game.data.kind_set_size(game.special_kinds.meatbug, 0.4f);
-	game.data.kind_set_speed(game.special_kinds.meatbug, 0.02f);
+void draw_things_culled(state& data, things_filter filter = things_filter::all) {
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, data.culling.group_commands);
+	for (size_t i = 0; i < data.kinds.size(); i++) {
+		auto& kind = data.kinds[i];
+		if (kind.vao == 0 || !passes(kind, filter)) {
+			continue;
+		}
+		auto command = [](size_t group) {
+			return reinterpret_cast<void*>(group * sizeof(draw_elements_command));
+		};
+		glBindVertexArray(kind.culled_vao);
+		glDrawElementsIndirect(GL_TRIANGLES, INDEX_TYPE, command(2 * i));
+		glBindVertexArray(kind.culled_dead_vao);
+		glDrawElementsIndirect(GL_TRIANGLES, INDEX_TYPE, command(2 * i + 1));
+		// instance counts stay on the gpu, vertices are not counted
+		count_state_changes(data, 2);
+		count_draw(data, 0);
+		count_draw(data, 0);
+	}
+	count_state_changes(data);
+}
 
-	game.special_kinds.meatbug_queen = game.data.create_kind();
-	game.data.kind_set_size(game.special_kinds.meatbug_queen, 2.f);
-	game.data.kind_set_speed(game.special_kinds.meatbug_queen, 0.01f);
+// the map, the cache and the blur target always share one format, which makes them copyable
+void allocate_shadow_storage(shadow_cache& cache) {
+	auto format = cache.half_precision ? GL_RG16F : GL_RG32F;
+	for (auto [texture, layers] : {std::pair{cache.map, SHADOW_CASCADES}, {cache.static_map, SHADOW_CASCADES}, {cache.blurred, 1}}) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, cache.resolution, cache.resolution, layers, 0, GL_RGBA, GL_FLOAT, nullptr);
+	}
+	cache.static_version++;
+}
 
-	game.special_kinds.potion_flower = game.data.create_kind();
-	game.data.kind_set_size(game.special_kinds.potion_flower, 0.1f);
-	game.data.kind_set_speed(game.special_kinds.potion_flower, 0.f);
-	game.data.kind_set_preserved_after_death(game.special_kinds.potion_flower, true);
+float evsm_exponent(shadow_cache& cache) {
+	return cache.half_precision ? SHADOW_EVSM_EXPONENT : 0.f;
+}
 
-	game.special_kinds.tree = game.data.create_kind();
-	game.data.kind_set_size(game.special_kinds.tree, 0.2f);
-	game.data.kind_set_speed(game.special_kinds.tree, 0.f);
-	game.data.kind_set_preserved_after_death(game.special_kinds.tree, true);
+// moments of the far plane, where nothing casts shadows
+glm::vec2 empty_moments(shadow_cache& cache) {
+	auto w = cache.half_precision ? std::exp(SHADOW_EVSM_EXPONENT) : 1.f;
+	return {w, w * w};
+}
 
-	game.data.force_create_food_hierarchy(game.special_kinds.human, game.special_kinds.meatbug);
-	game.data.force_create_food_hierarchy(game.special_kinds.human, rat);
-	game.data.force_create_food_hierarchy(rat, game.special_kinds.meatbug);
-	game.data.force_create_food_hierarchy(game.special_kinds.meatbug, game.special_kinds.meatflower);
-	game.data.force_create_food_hierarchy(game.special_kinds.meatbug_queen, game.special_kinds.meatflower);
-	game.data.force_create_food_hierarchy(game.special_kinds.meatbug_queen, game.special_kinds.meatbug);
+GLuint create_shadow_texture() {
+	GLuint result;
+	glGenTextures(1, &result);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, result);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return result;
+}
 
-	{
-		game.personality.hunter = game.data.create_ai_model();
-		game.data.ai_model_set_stockpile_target(game.personality.hunter, game.potion, 7);
-		game.data.ai_model_set_stockpile_target(game.personality.hunter, game.prepared_food, 3);
-	}
+// allocates the shadow map as well, its framebuffers are left to the caller
+void init_shadow_cache(shadow_cache& cache, GLuint shadow_map, GLsizei resolution, GLuint blur_program) {
+	cache.resolution = resolution;
+	cache.map = shadow_map;
+	cache.static_map = create_shadow_texture();
+	cache.blurred = create_shadow_texture();
+	allocate_shadow_storage(cache);
+
+	cache.blur_program = blur_program;
+	cache.blur_source_location = glGetUniformLocation(blur_program, "source");
+	cache.blur_layer_location = glGetUniformLocation(blur_program, "layer");
+	cache.blur_direction_location = glGetUniformLocation(blur_program, "direction");
+	glGenVertexArrays(1, &cache.empty_vao);
+
+	glGenFramebuffers(1, &cache.blurred_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cache.blurred_fbo);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, cache.blurred, 0, 0);
+	if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		throw std::runtime_error("Incomplete framebuffer!");
 
-	{
-		game.personality.shopkeeper = game.data.create_ai_model();
-		game.data.for_each_commodity([&](auto commodity){
-			if (commodity == game.coins) {
-				return;
-			}
-			game.data.ai_model_set_stockpile_target(game.personality.shopkeeper, commodity, 10);
-		});
+	glGenRenderbuffers(SHADOW_CASCADES, cache.static_depth.data());
+	glGenFramebuffers(SHADOW_CASCADES, cache.static_fbo.data());
+	for (GLsizei i = 0; i < SHADOW_CASCADES; i++) {
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cache.static_fbo[i]);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, cache.static_map, 0, i);
+		glBindRenderbuffer(GL_RENDERBUFFER, cache.static_depth[i]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, resolution, resolution);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, cache.static_depth[i]);
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			throw std::runtime_error("Incomplete framebuffer!");
 	}
+}
 
-	{
-		game.personality.innkeeper = game.data.create_ai_model();
-		game.data.ai_model_set_stockpile_target(game.personality.innkeeper, game.raw_food, 10);
-		game.data.ai_model_set_stockpile_target(game.personality.innkeeper, game.prepared_food, 5);
-		game.data.ai_model_set_stockpile_target(game.personality.innkeeper, game.potion, 1);
+// the direction used for shadows, follows the light only once it moved far enough
+glm::vec3 shadow_light_direction(shadow_cache& cache, glm::vec3 light) {
+	light = glm::normalize(light);
+	if (glm::dot(light, cache.light_direction) < std::cos(SHADOW_LIGHT_STEP)) {
+		cache.light_direction = light;
 	}
+	return cache.light_direction;
+}
 
-	{
-		game.personality.alchemist = game.data.create_ai_model();
-		game.data.ai_model_set_stockpile_target(game.personality.alchemist, game.prepared_food, 5);
-		game.data.ai_model_set_stockpile_target(game.personality.alchemist, game.potion_material, 10);
-	}
+bool shadow_cascade_stale(shadow_cache& cache, GLsizei cascade, glm::mat4 const& projection) {
+	return cache.versions[cascade] != cache.static_version || cache.projections[cascade] != projection;
+}
 
-	{
-		game.personality.weapon_master = game.data.create_ai_model();
-		game.data.ai_model_set_stockpile_target(game.personality.weapon_master, game.prepared_food, 5);
-		game.data.ai_model_set_stockpile_target(game.personality.weapon_master, game.potion, 1);
-	}
+// starts the shadow map of the frame from the cached static casters
+void restore_static_shadows(shadow_cache& cache, GLsizei cascade, GLuint shadow_depth) {
+	glCopyImageSubData(
+		cache.static_map, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+		cache.map, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+		cache.resolution, cache.resolution, 1
+	);
+	glCopyImageSubData(
+		cache.static_depth[cascade], GL_RENDERBUFFER, 0, 0, 0, 0,
+		shadow_depth, GL_RENDERBUFFER, 0, 0, 0, 0,
+		cache.resolution, cache.resolution, 1
+	);
+}
 
-	{
-		game.personality.herbalist = game.data.create_ai_model();
-		game.data.ai_model_set_stockpile_target(game.personality.herbalist, game.prepared_food, 5);
-		game.data.ai_model_set_stockpile_target(game.personality.herbalist, game.potion, 1);
-	}
+void blur_pass(state& data, GLuint source, GLint layer, glm::vec2 direction) {
+	auto& cache = data.shadows;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, source);
+	glUniform1i(cache.blur_layer_location, layer);
+	glUniform2f(cache.blur_direction_location, direction.x, direction.y);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	count_state_changes(data);
+	count_draw(data, 3);
+}
 
-	{
-		auto deliverer_model = game.data.create_ai_model();
-		game.data.ai_model_set_stockpile_target(deliverer_model, game.prepared_food, 5);
-		game.data.ai_model_set_stockpile_target(deliverer_model, game.potion, 1);
+// prefilters the moments once per frame, so shading needs a single fetch
+// cascade_fbo[i] renders into layer i of the shadow map
+void blur_shadows(state& data, GLuint const* cascade_fbo) {
+	auto& cache = data.shadows;
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glViewport(0, 0, cache.resolution, cache.resolution);
+	glUseProgram(cache.blur_program);
+	glUniform1i(cache.blur_source_location, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindVertexArray(cache.empty_vao);
+	count_state_changes(data, 2);
+
+	auto texel = 1.f / (float)cache.resolution;
+	for (GLsizei i = 0; i < SHADOW_CASCADES; i++) {
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cache.blurred_fbo);
+		blur_pass(data, cache.map, i, {texel, 0.f});
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cascade_fbo[i]);
+		blur_pass(data, cache.blurred, 0, {0.f, texel});
+		count_state_changes(data, 2);
 	}
+}
 
-
-	// {
-	// 	auto deliverer = game.data.create_character();
-	// 	game.data.character_set_hp(deliverer, 100);
-	// 	game.data.character_set_hp_max(deliverer, 100);
-	// }
-	for (int i = 0; i < 4; i++) {
-		auto hunter = game.data.create_character();
-		auto hunter_body = game.data.create_thing();
-		game.data.thing_set_kind(hunter_body, game.special_kinds.human);
-		game.data.force_create_embodiment(hunter, hunter_body);
-		game.data.thing_set_hp(hunter_body, 100);
-		game.data.thing_set_hp_max(hunter_body, 100);
-		game.data.character_set_ai_type(hunter, game.personality.hunter);
-		game.data.character_set_weapon_quality(hunter, 1.f);
-		game.data.character_set_inventory(hunter, game.coins, 10);
+void init_post_process(post_process& post, GLuint program) {
+	post.program = program;
+	post.color_location = glGetUniformLocation(program, "color_buffer");
+	post.depth_location = glGetUniformLocation(program, "depth_buffer");
+	post.inverse_projection_location = glGetUniformLocation(program, "inverse_projection");
+	post.ambient_location = glGetUniformLocation(program, "ambient");
+
+	glGenVertexArrays(1, &post.empty_vao);
+	glGenFramebuffers(1, &post.fbo);
+	for (auto texture : {&post.color, &post.depth}) {
+		glGenTextures(1, texture);
+		glBindTexture(GL_TEXTURE_2D, *texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	}
+}
 
-	{
-		auto inn = game.data.create_building();
-		game.data.building_set_tile_x(inn, 0);
-		game.data.building_set_tile_y(inn, 0);
-		game.data.building_set_building_model(inn, game.inn);
-
-		auto innkeeper = game.data.create_character();
-		auto innkeeper_body = game.data.create_thing();
-		game.data.thing_set_hp(innkeeper_body, 100);
-		game.data.thing_set_hp_max(innkeeper_body, 100);
-		game.data.thing_set_kind(innkeeper_body, game.special_kinds.human);
-		game.data.force_create_embodiment(innkeeper, innkeeper_body);
-		game.data.character_set_inventory(innkeeper, game.coins, 100);
-		game.data.character_set_ai_type(innkeeper, game.personality.innkeeper);
-		game.data.character_set_skills(innkeeper, game.skills.cooking, 0.3f);
-
-		game.data.force_create_ownership(innkeeper, inn);
-	}
-	{
-		auto shop = game.data.create_building();
-		game.data.building_set_tile_x(shop, 3);
-		game.data.building_set_tile_y(shop, 3);
-		game.data.building_set_building_model(shop, game.shop);
-		auto shop_owner = game.data.create_character();
-		auto body = game.data.create_thing();
-		game.data.thing_set_hp(body, 100);
-		game.data.thing_set_hp_max(body, 100);
-		game.data.thing_set_kind(body, game.special_kinds.human);
-		game.data.force_create_embodiment(shop_owner, body);
-		game.data.character_set_inventory(shop_owner, game.coins, 100);
-		game.data.character_set_ai_type(shop_owner, game.personality.shopkeeper);
-
-		game.data.force_create_ownership(shop_owner, shop);
+// follows the size of the window
+void resize_post_process(post_process& post, int width, int height) {
+	if (post.width == width && post.height == height) {
+		return;
 	}
-	{
-		auto shop_weapons = game.data.create_building();
-		game.data.building_set_tile_x(shop_weapons, 3);
-		game.data.building_set_tile_y(shop_weapons, 0);
-		game.data.building_set_building_model(shop_weapons, game.shop_weapon);
-		auto weapon_master = game.data.create_character();
-		auto body = game.data.create_thing();
-		game.data.thing_set_hp(body, 100);
-		game.data.thing_set_hp_max(body, 100);
-		game.data.thing_set_kind(body, game.special_kinds.human);
-		game.data.force_create_embodiment(weapon_master, body);
-		game.data.character_set_inventory(weapon_master, game.coins, 10);
-		game.data.character_set_ai_type(weapon_master, game.personality.weapon_master);
-
-		game.data.force_create_ownership(weapon_master, shop_weapons);
-	}
-
-	for (int i = 0; i < 2; i++) {
-		auto alchemist = game.data.create_character();
-		auto body = game.data.create_thing();
-		game.data.thing_set_hp(body, 100);
-		game.data.thing_set_hp_max(body, 100);
-		game.data.thing_set_kind(body, game.special_kinds.human);
-		game.data.force_create_embodiment(alchemist, body);
-		game.data.character_set_inventory(alchemist, game.coins, 100);
-		game.data.character_set_ai_type(alchemist, game.personality.alchemist);
-	}
-
-	for (int i = 0; i < 2; i++) {
-		auto herbalist = game.data.create_character();
-		auto body = game.data.create_thing();
-		game.data.thing_set_hp(body, 100);
-		game.data.thing_set_hp_max(body, 100);
-		game.data.thing_set_kind(body, game.special_kinds.human);
-		game.data.force_create_embodiment(herbalist, body);
-		game.data.character_set_ai_type(herbalist, game.personality.herbalist);
-	}
-
-	game.data.for_each_character([&](auto cid) {
-		game.data.for_each_commodity([&](auto commodity) {
-			game.data.character_set_price_belief_buy(cid, commodity, 1.f);
-			game.data.character_set_price_belief_sell(cid, commodity, 1.f);
-		});
+	post.width = width;
+	post.height = height;
 
-		// select initial favorite shops
-		game.data.for_each_building([&](auto candidate_building){
-			auto candidate = game.data.building_get_owner_from_ownership(candidate_building);
-			dcon::ai_model_id model = game.data.character_get_ai_type(candidate);
-			if (model == game.personality.innkeeper) {
-				game.data.character_set_favourite_inn(cid, candidate_building);
-			}
-			if (model == game.personality.weapon_master) {
-				game.data.character_set_favourite_shop_weapons(cid, candidate_building);
-			}
-			if (model == game.personality.shopkeeper) {
-				game.data.character_set_favourite_shop(cid, candidate_building);
-			}
-		});
-	});
-
-	for (int i = 0; i < 50; i++) {
-		auto queen = game.data.create_thing();
-		game.data.thing_set_kind(queen, game.special_kinds.meatbug_queen);
-		game.data.thing_set_hp(queen, 300);
-		game.data.thing_set_hp_max(queen, 30);
-		game.data.thing_set_x(queen, game.uniform(game.rng) * 100.f - 50.f);
-		game.data.thing_set_y(queen, game.uniform(game.rng) * 100.f - 50.f);
-		game.data.thing_set_direction(queen, game.uniform(game.rng) * glm::pi<float>() * 2);
-	}
-
-	// spawn trees
-
-	auto forest_x = 30.f;
-	auto forest_y = 30.f;
-
-	for (int i = 0; i < 50; i++) {
-		auto thing = game.data.create_thing();
-		game.data.thing_set_kind(thing, game.special_kinds.tree);
-		game.data.thing_set_hp(thing, 30);
-		game.data.thing_set_hp_max(thing, 30);
-		game.data.thing_set_x(thing, game.normal(game.rng) * 10.f  + forest_x);
-		game.data.thing_set_y(thing, game.normal(game.rng) * 10.f  + forest_y);
-		game.data.thing_set_direction(thing, game.uniform(game.rng) * glm::pi<float>() * 2);
-	}
-
-	for (int i = 0; i < 2000; i++) {
-		auto flower = game.data.create_thing();
-		game.data.thing_set_kind(flower, game.special_kinds.meatflower);
-		game.data.thing_set_hp(flower, 3);
-		game.data.thing_set_hp_max(flower, 3);
-		game.data.thing_set_x(flower, game.uniform(game.rng) * 100.f - 50.f);
-		game.data.thing_set_y(flower, game.uniform(game.rng) * 100.f - 50.f);
-		game.data.thing_set_direction(flower, game.uniform(game.rng) * glm::pi<float>() * 2);
-	}
-}
-
-void update(state& game) {
-	game.data.for_each_character([&](auto cid) {
-		auto model = game.data.character_get_ai_type(cid);
-		if (model == game.personality.hunter) {
-			ai::update::hunter(game, cid);
-		} else if (model == game.personality.alchemist) {
-			ai::update::alchemist(game, cid);
-		} else if (model == game.personality.herbalist) {
-			gather_potion_material(game, cid);
-
-			auto timer = game.data.character_get_action_timer(cid);
-			game.data.character_set_action_timer(cid, timer + 1);
-		} else if (model == game.personality.innkeeper) {
-			auto material_cost = game.data.character_get_price_belief_buy(cid, game.raw_food);
-			auto production_cost = game.data.character_get_price_belief_sell(cid, game.prepared_food);
-			if (
-				game.data.character_get_inventory(cid, game.raw_food) >= 1.f
-				&& production_cost > material_cost
-			) {
-				printf("make food\n");
-				prepare_food(game, cid);
-			}
+	glBindTexture(GL_TEXTURE_2D, post.color);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	glBindTexture(GL_TEXTURE_2D, post.depth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
 
-			auto timer = game.data.character_get_action_timer(cid);
-			game.data.character_set_action_timer(cid, timer + 1);
-		}
-	});
-
-	game.data.for_each_thing([&](auto id) {
-		auto kind = game.data.thing_get_kind(id);
-		if (!game.data.kind_get_preserved_after_death(kind)) {
-			auto hunger = game.data.thing_get_hunger(id);
-			game.data.thing_set_hunger(id, hunger + 1);
-			if (game.data.thing_get_hunger(id) > 10000) {
-				game.data.delete_thing(id);
-			}
-		}
-	});
-
-	// trade:
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, post.fbo);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, post.color, 0);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, post.depth, 0);
+	if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		throw std::runtime_error("Incomplete framebuffer!");
+}
 
-	// ai logic would be very simple:
-	// sell things you don't desire yourself
-	// buy things you desire and miss
+// draws the shaded scene into the window
+void apply_post_process(state& data, glm::mat4 const& projection, glm::vec3 ambient) {
+	auto& post = data.post;
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	glUseProgram(post.program);
+	auto inverse_projection = glm::inverse(projection);
+	glUniformMatrix4fv(post.inverse_projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&inverse_projection));
+	glUniform3fv(post.ambient_location, 1, reinterpret_cast<float *>(&ambient));
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, post.color);
+	glUniform1i(post.color_location, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, post.depth);
+	glUniform1i(post.depth_location, 1);
+
+	glBindVertexArray(post.empty_vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glActiveTexture(GL_TEXTURE0);
+	count_state_changes(data, 5);
+	count_draw(data, 3);
+}
 
-	// currently we can buy things only from the favourite shop:
+}
 
-	for (int round = 0; round < 3; round++) {
-		game.data.for_each_character([&](auto cid) {
-			auto body =  game.data.character_get_body_from_embodiment(cid);
-			game.data.for_each_commodity([&](auto commodity) {
-				if (commodity == game.coins) {
-					return;
-				}
-				if (commodity == game.weapon_service) {
-					return;
-				}
 
-				auto shop = game.data.character_get_favourite_shop(cid);
-				auto action = game.ai.shopping;
-				if (commodity == game.prepared_food) {
-					shop = game.data.character_get_favourite_inn(cid);
-					action = game.ai.getting_food;
-				}
+// how much the frame loop pays for catching opengl mistakes
+enum class gl_validation {
+	// no debug context and no glGetError
+	off,
+	// debug context, the driver reports into a ring buffer which is printed once per frame
+	async,
+	// synchronous debug output and glGetError after every pass, stops at the first error
+	sync,
+};
 
-				if (
-					game.data.character_get_ai_type(cid) == game.personality.hunter
-					|| game.data.character_get_ai_type(cid) == game.personality.alchemist
-				) {
-					auto guest_in = game.data.thing_get_guest_location_from_guest(body);
-					if (game.data.character_get_action_type(cid) != action) {
-						return;
-					}
+#ifdef NDEBUG
+static gl_validation validation = gl_validation::off;
+#else
+static gl_validation validation = gl_validation::async;
+#endif
 
-					if (guest_in != shop) {
-						return;
-					}
-				}
+void print_debug_message(GLenum source, GLenum type, unsigned int id, GLenum severity, const char *message) {
+	// ignore non-significant error/warning codes
+	if(id == 131169 || id == 131185 || id == 131218 || id == 131204) return;
 
-				auto shop_owner = game.data.building_get_owner_from_ownership(shop);
-				if (cid == shop_owner) {
-					return;
-				}
-				// auto desire = game.data.character_get_hunger(cid, commodity);
-				auto ai = game.data.character_get_ai_type(cid);
-				auto target = game.data.ai_model_get_stockpile_target(ai, commodity);
-				auto inventory = game.data.character_get_inventory(cid, commodity);
-				auto in_stock = game.data.character_get_inventory(shop_owner, commodity);
-				auto coins = game.data.character_get_inventory(cid, game.coins);
-				auto desired_price_buy = game.data.character_get_price_belief_buy(cid, commodity);
-				auto desired_price_sell = game.data.character_get_price_belief_sell(cid, commodity);
-				auto coins_shop = game.data.character_get_inventory(shop_owner, game.coins);
-				auto price_shop_sell = game.data.character_get_price_belief_sell(shop_owner, commodity);
-				auto price_shop_buy = game.data.character_get_price_belief_buy(shop_owner, commodity);
-
-				auto bottom_price = game.data.character_get_price_belief_buy(cid, game.prepared_food) / 5.f;
-
-				float ordered = 0.f;
-				auto delayed = game.data.get_delayed_transaction_by_transaction_pair(shop_owner, cid);
-				if (delayed) {
-					auto A = game.data.delayed_transaction_get_members(delayed, 0);
-					auto B = game.data.delayed_transaction_get_members(delayed, 1);
-					auto debt = game.data.delayed_transaction_get_balance(delayed, commodity);
-					auto mult = 1.f;
-					if (A != shop_owner) {
-						mult = -1.f;
-					}
-					ordered += debt * mult;
-				}
+	std::cout << "---------------" << std::endl;
+	std::cout << "Debug message (" << id << "): " <<  message << std::endl;
 
-				if (target > inventory + ordered) {
-					// printf("I need this? %d %f %f %f\n", commodity.index(), desired_price_buy, price_shop_sell, in_stock );
-					if (desired_price_buy >= price_shop_sell && in_stock >= 1.f && coins >= price_shop_sell) {
-						printf("I am buying %s\n", game::get_name(game, commodity).c_str());
-						transaction(game, shop_owner, cid, commodity, 1.f);
-						transaction(game, cid, shop_owner, game.coins, price_shop_sell);
-					} else if (desired_price_buy >= price_shop_sell && coins >= price_shop_sell) {
-						printf("I am ordering %s\n", game::get_name(game, commodity).c_str());
-						auto delayed = game.data.get_delayed_transaction_by_transaction_pair(cid, shop_owner);
-						bool already_indebted = false;
-						if (delayed) {
+	switch (source)
+	{
+		case GL_DEBUG_SOURCE_API:             std::cout << "Source: API"; break;
+		case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   std::cout << "Source: Window System"; break;
+		case GL_DEBUG_SOURCE_SHADER_COMPILER: std::cout << "Source: Shader Compiler"; break;
+		case GL_DEBUG_SOURCE_THIRD_PARTY:     std::cout << "Source: Third Party"; break;
+		case GL_DEBUG_SOURCE_APPLICATION:     std::cout << "Source: Application"; break;
+		case GL_DEBUG_SOURCE_OTHER:           std::cout << "Source: Other"; break;
+	} std::cout << std::endl;
 
-						}
-						delayed_transaction(game, shop_owner, cid, commodity, 1.f);
-						transaction(game, cid, shop_owner, game.coins, price_shop_sell);
-						// if (!already_indebted) {
-						// } else {
-						// 	printf("But I have already ordered a lot\n");
-						// }
-					} else if (desired_price_buy >= price_shop_sell && in_stock >= 1.f) {
-						printf("I am buying %s with a loan\n", game::get_name(game, commodity).c_str());
-						transaction(game, shop_owner, cid, commodity, 1.f);
-						delayed_transaction(game, cid, shop_owner, game.coins, price_shop_sell);
-					}
-				}
+	switch (type)
+	{
+		case GL_DEBUG_TYPE_ERROR:               std::cout << "Type: Error"; break;
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: std::cout << "Type: Deprecated Behaviour"; break;
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  std::cout << "Type: Undefined Behaviour"; break;
+		case GL_DEBUG_TYPE_PORTABILITY:         std::cout << "Type: Portability"; break;
+		case GL_DEBUG_TYPE_PERFORMANCE:         std::cout << "Type: Performance"; break;
+		case GL_DEBUG_TYPE_MARKER:              std::cout << "Type: Marker"; break;
+		case GL_DEBUG_TYPE_PUSH_GROUP:          std::cout << "Type: Push Group"; break;
+		case GL_DEBUG_TYPE_POP_GROUP:           std::cout << "Type: Pop Group"; break;
+		case GL_DEBUG_TYPE_OTHER:               std::cout << "Type: Other"; break;
+	} std::cout << std::endl;
 
-				if (target < inventory && price_shop_buy > bottom_price && in_stock < spoilage_threshold) {
-					// printf("I do not need this? %d %f %f %f\n", commodity.index(), desired_price_sell, price_shop_buy, in_stock );
-
-					if (price_shop_buy >= desired_price_sell && inventory >= 1.f && coins_shop >= price_shop_buy) {
-						printf("I am selling %s\n", game::get_name(game, commodity).c_str());
-						transaction(game, cid, shop_owner, commodity, 1.f);
-						transaction(game, shop_owner, cid, game.coins, price_shop_buy);
-					} else if (price_shop_buy >= desired_price_sell && inventory >= 1.f) {
-						printf("I am selling %s for promise of future payment\n", game::get_name(game, commodity).c_str());
-						transaction(game, cid, shop_owner, commodity, 1.f);
-						delayed_transaction(game, shop_owner, cid, game.coins, price_shop_buy);
-					}
-				}
+	switch (severity)
+	{
+		case GL_DEBUG_SEVERITY_HIGH:         std::cout << "Severity: high"; break;
+		case GL_DEBUG_SEVERITY_MEDIUM:       std::cout << "Severity: medium"; break;
+		case GL_DEBUG_SEVERITY_LOW:          std::cout << "Severity: low"; break;
+		case GL_DEBUG_SEVERITY_NOTIFICATION: std::cout << "Severity: notification"; break;
+	} std::cout << std::endl;
+	std::cout << std::endl;
+}
 
+// bounded multi producer queue: drivers may call the callback from their own threads
+// a full ring drops the message instead of waiting
+namespace gl_messages {
 
-				// convergence of beliefs during interaction:
+constexpr size_t CAPACITY = 256;
+constexpr size_t TEXT_SIZE = 256;
 
-				auto alpha = 0.01f;
-				{
-					auto shift = price_shop_sell - desired_price_buy;
-					game.data.character_set_price_belief_buy(cid, commodity, desired_price_buy + shift * alpha);
-				}
-				{
-					auto shift = price_shop_buy - desired_price_sell;
-					game.data.character_set_price_belief_sell(cid, commodity, desired_price_sell + shift * alpha);
-				}
-			});
-		});
-	}
+struct message {
+	GLenum source;
+	GLenum type;
+	GLuint id;
+	GLenum severity;
+	char text[TEXT_SIZE];
+};
 
-	// fulfill promises:
-	game.data.for_each_delayed_transaction([&](auto delayed) {
-		auto A = game.data.delayed_transaction_get_members(delayed, 0);
-		auto B = game.data.delayed_transaction_get_members(delayed, 1);
+struct slot {
+	// equals the position which may write the slot next, position + 1 once it's readable
+	std::atomic<size_t> sequence;
+	message data;
+};
 
-		game.data.for_each_commodity([&](auto commodity) {
-			auto debt = game.data.delayed_transaction_get_balance(delayed, commodity);
-			if (debt > 0) {
-				auto inv = game.data.character_get_inventory(A, commodity);
-				if (inv >= 1) {
-					transaction(game, A, B, commodity, 1.f);
-					delayed_transaction(game, A, B, commodity, -1.f);
-				}
-			} else if (debt < 0) {
-				auto inv = game.data.character_get_inventory(B, commodity);
-				if (inv >= 1) {
-					transaction(game, B, A, commodity, 1.f);
-					delayed_transaction(game, B, A, commodity, -1.f);
-				}
-			}
-		});
-	});
+struct ring {
+	std::array<slot, CAPACITY> slots;
+	std::atomic<size_t> write {0};
+	std::atomic<size_t> dropped {0};
+	// consumer only
+	size_t read = 0;
 
-	game.data.for_each_character([&](auto cid) {
-		auto body = game.data.character_get_body_from_embodiment(cid);
-		if (game.data.thing_get_hunger(body) > BASE_FOOD_NUTRITION * 1.5f) {
-			eat(game, cid);
+	ring() {
+		for (size_t i = 0; i < CAPACITY; i++) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
 		}
-		drink_potion(game, cid);
-	});
-
-	// event: if commodity is not selling well: reduce sell price:
-	game.price_update_tick++;
-	if (game.price_update_tick > 4) {
-		game.price_update_tick = 0;
 	}
-	if (game.price_update_tick  == 0) {
-		game.data.for_each_character([&](auto cid) {
-			if (game.data.character_get_ai_type(cid) == game.personality.weapon_master) {
-				auto cost = game.data.character_get_price_belief_sell(cid, game.weapon_service);
-				game.data.character_set_price_belief_sell(cid, game.weapon_service, cost * 0.99f);
-			}
-			game.data.for_each_commodity([&](auto commodity) {
-				if (commodity == game.coins) {
-					return;
-				}
-				if (commodity == game.weapon_service) {
-					return;
-				}
-
-				auto inventory = game.data.character_get_inventory(cid, commodity);
-				auto ai = game.data.character_get_ai_type(cid);
-				auto target = game.data.ai_model_get_stockpile_target(ai, commodity);
-
-				auto spoilage = (float)(int)(inventory / spoilage_threshold);
-
-				if (inventory > target * 2) {
-					auto price_decay_sell = exp(-inventory / target * 0.05f);
-					auto price_decay_buy =exp(-inventory / target * 0.1f);
-
-					auto price_shop_sell = game.data.character_get_price_belief_sell(cid, commodity);
-					game.data.character_set_price_belief_sell(cid, commodity, std::max(0.00001f,  price_shop_sell * price_decay_sell));
-
-					auto price_shop_buy = game.data.character_get_price_belief_buy(cid, commodity);
-					game.data.character_set_price_belief_buy(cid, commodity, std::max(0.00001f, price_shop_buy * price_decay_buy));
-				}
-
-				// if something is spoiling, we want to get rid of it
-				if (spoilage > 0) {
-					auto price_decay_sell = exp(-spoilage * 0.05f);
-					auto price_decay_buy =exp(-spoilage * 0.1f);
-					// spoilage
-					game.data.character_set_inventory(cid, commodity, inventory - (float)(int)(inventory / 20));
-
-					auto price_shop_sell = game.data.character_get_price_belief_sell(cid, commodity);
-					game.data.character_set_price_belief_sell(cid, commodity, 0.00001f + price_shop_sell * price_decay_sell);
-
-					auto price_shop_buy = game.data.character_get_price_belief_buy(cid, commodity);
-					game.data.character_set_price_belief_buy(cid, commodity, 0.00001f + price_shop_buy * price_decay_buy);
-				}
-
-				auto coins = game.data.character_get_inventory(cid, game.coins);
-
-				if (inventory < target) {
-					auto lack = (float)(target - inventory) / (float)target;
-					auto mult_buy = exp(lack  * 0.05f);
-
-					auto price_shop_buy = game.data.character_get_price_belief_buy(cid, commodity);
-					game.data.character_set_price_belief_buy(cid, commodity, std::min(coins + 10.f,  price_shop_buy * mult_buy));
-					auto price_shop_sell = game.data.character_get_price_belief_sell(cid, commodity);
-
-					if (game.data.character_get_ai_type(cid) == game.personality.shopkeeper) {
-						game.data.character_set_price_belief_sell(cid, commodity,  price_shop_buy * mult_buy);
-					} else {
-						game.data.character_set_price_belief_sell(cid, commodity, std::min(coins + 10.f,  price_shop_sell * mult_buy));
-					}
-				}
-			});
-		});
-	}
-
-
-	game.data.execute_parallel_over_thing([&](auto critter){
-		auto kind = game.data.thing_get_kind(critter);
-		auto speed = game.data.kind_get_speed(kind);
-
-		auto soul = game.data.thing_get_embodier_from_embodiment(critter);
-		auto following = game.data.thing_get_follow_target_as_follower(critter);
-		auto target = game.data.follow_target_get_followed(following);
-		auto x = game.data.thing_get_x(critter);
-		auto y = game.data.thing_get_y(critter);
-
-		auto cx = ve::select(target == dcon::thing_id{}, x, game.data.thing_get_x(target));
-		auto cy = ve::select(target == dcon::thing_id{}, y, game.data.thing_get_y(target));
-
-		auto alpha = game.data.thing_get_direction(critter);
-		auto dx = ve::apply([&](float alpha_v){return sin(alpha_v);}, alpha);
-		auto dy = ve::apply([&](float alpha_v){return -cos(alpha_v);}, alpha);
-
-		auto fdx = cx - x;
-		auto fdy = cy - y;
-
-		auto fn = ve::sqrt(fdx * fdx + fdy * fdy);
-
-		fdx = ve::select(fn > speed, fdx / fn, fdx) * 0.05f;
-		fdy = ve::select(fn > speed, fdy / fn, fdy) * 0.05f;
-
-		dx = ve::select(soul == dcon::character_id{}, dx * 0.05f, 0.f);
-		dy = ve::select(soul == dcon::character_id{}, dy * 0.05f, 0.f);
-		game.data.thing_set_x(critter, x + (dx + fdx) * speed);
-		game.data.thing_set_y(critter, y + (dy + fdy) * speed);
-	});
-
-	std::vector<dcon::thing_id> will_give_birth {};
-
-	game.data.for_each_thing([&](auto critter){
-		auto soul = game.data.thing_get_embodier_from_embodiment(critter);
-		if (!soul) {
-			auto alpha = game.data.thing_get_direction(critter);
-			game.data.thing_set_direction(critter, alpha + 0.1f * game.uniform(game.rng) - 0.05f);
-		}
+};
 
-		auto kind = game.data.thing_get_kind(critter);
-		auto hunger = game.data.thing_get_hunger(critter);
-		if (kind == game.special_kinds.meatbug_queen) {
-			if (hunger < 1000) {
-				if (game.uniform(game.rng) < 0.01f) {
-					will_give_birth.push_back(critter);
-				}
-			}
-			ai::update::meatbug(game, critter);
-		} else if (kind == game.special_kinds.meatbug) {
-			ai::update::meatbug(game, critter);
-		} else if (kind == game.special_kinds.meatflower) {
-			auto hp = game.data.thing_get_hp(critter);
-			auto hp_max = game.data.thing_get_hp_max(critter);
-			if (game.uniform(game.rng) < 0.05f) {
-				game.data.thing_set_hp(critter, std::min(hp + 1, hp_max));
+static ring messages;
+
+void push(ring& data, message const& item) {
+	auto position = data.write.load(std::memory_order_relaxed);
+	while (true) {
+		auto& target = data.slots[position % CAPACITY];
+		auto sequence = target.sequence.load(std::memory_order_acquire);
+		if (sequence == position) {
+			if (data.write.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				target.data = item;
+				target.sequence.store(position + 1, std::memory_order_release);
+				return;
 			}
+		} else if (sequence < position) {
+			data.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			position = data.write.load(std::memory_order_relaxed);
 		}
-	});
-
-	for (auto& mother : will_give_birth) {
-		auto child = game.data.create_thing();
-		game.data.thing_set_kind(child, game.special_kinds.meatbug);
-		game.data.thing_set_hp(child, 30);
-		game.data.thing_set_hp_max(child, 30);
-		game.data.thing_set_x(child, game.data.thing_get_x(mother));
-		game.data.thing_set_y(child, game.data.thing_get_y(mother));
-		game.data.force_create_follow_target(child, mother);
 	}
 }
 
+bool pop(ring& data, message& item) {
+	auto& source = data.slots[data.read % CAPACITY];
+	if (source.sequence.load(std::memory_order_acquire) != data.read + 1) {
+		return false;
+	}
+	item = source.data;
+	source.sequence.store(data.read + CAPACITY, std::memory_order_release);
+	data.read++;
+	return true;
 }
 
+}
 
-void APIENTRY glDebugOutput(
-	GLenum source,
-	GLenum type,
-	unsigned int id,
-	GLenum severity,
-	GLsizei length,
-	const char *message,
-	const void *userParam
-) {
-	// ignore non-significant error/warning codes
-	if(id == 131169 || id == 131185 || id == 131218 || id == 131204) return;
-
-	std::cout << "---------------" << std::endl;
-	std::cout << "Debug message (" << id << "): " <<  message << std::endl;
-
-	switch (source)
-	{
-		case GL_DEBUG_SOURCE_API:             std::cout << "Source: API"; break;
-		case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   std::cout << "Source: Window System"; break;
-		case GL_DEBUG_SOURCE_SHADER_COMPILER: std::cout << "Source: Shader Compiler"; break;
-		case GL_DEBUG_SOURCE_THIRD_PARTY:     std::cout << "Source: Third Party"; break;
-		case GL_DEBUG_SOURCE_APPLICATION:     std::cout << "Source: Application"; break;
-		case GL_DEBUG_SOURCE_OTHER:           std::cout << "Source: Other"; break;
-	} std::cout << std::endl;
-
-	switch (type)
-	{
-		case GL_DEBUG_TYPE_ERROR:               std::cout << "Type: Error"; break;
-		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: std::cout << "Type: Deprecated Behaviour"; break;
-		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  std::cout << "Type: Undefined Behaviour"; break;
-		case GL_DEBUG_TYPE_PORTABILITY:         std::cout << "Type: Portability"; break;
-		case GL_DEBUG_TYPE_PERFORMANCE:         std::cout << "Type: Performance"; break;
-		case GL_DEBUG_TYPE_MARKER:              std::cout << "Type: Marker"; break;
-		case GL_DEBUG_TYPE_PUSH_GROUP:          std::cout << "Type: Push Group"; break;
-		case GL_DEBUG_TYPE_POP_GROUP:           std::cout << "Type: Pop Group"; break;
-		case GL_DEBUG_TYPE_OTHER:               std::cout << "Type: Other"; break;
-	} std::cout << std::endl;
+void APIENTRY glDebugOutput(
+	GLenum source,
+	GLenum type,
+	unsigned int id,
+	GLenum severity,
+	GLsizei length,
+	const char *message,
+	const void *userParam
+) {
+	if (validation == gl_validation::sync) {
+		print_debug_message(source, type, id, severity, message);
+		return;
+	}
+	gl_messages::message item {source, type, id, severity, {}};
+	auto size = std::min((size_t)(length < 0 ? strlen(message) : length), gl_messages::TEXT_SIZE - 1);
+	memcpy(item.text, message, size);
+	item.text[size] = '\0';
+	gl_messages::push(gl_messages::messages, item);
+}
 
-	switch (severity)
-	{
-		case GL_DEBUG_SEVERITY_HIGH:         std::cout << "Severity: high"; break;
-		case GL_DEBUG_SEVERITY_MEDIUM:       std::cout << "Severity: medium"; break;
-		case GL_DEBUG_SEVERITY_LOW:          std::cout << "Severity: low"; break;
-		case GL_DEBUG_SEVERITY_NOTIFICATION: std::cout << "Severity: notification"; break;
-	} std::cout << std::endl;
-	std::cout << std::endl;
+// main thread, once per frame
+void print_gl_messages() {
+	gl_messages::message item;
+	while (gl_messages::pop(gl_messages::messages, item)) {
+		print_debug_message(item.source, item.type, item.id, item.severity, item.text);
+	}
+	if (auto dropped = gl_messages::messages.dropped.exchange(0); dropped > 0) {
+		printf("%d OpenGL debug messages were dropped\n", (int)dropped);
+	}
+}
+
+// the context has to be created with GLFW_OPENGL_DEBUG_CONTEXT for anything but off
+void setup_gl_validation() {
+	if (validation == gl_validation::off) {
+		glDisable(GL_DEBUG_OUTPUT);
+		return;
+	}
+	glEnable(GL_DEBUG_OUTPUT);
+	if (validation == gl_validation::sync) {
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	} else {
+		glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	}
+	glDebugMessageCallback(glDebugOutput, nullptr);
 }
 
 struct base_triangle {
@@ -1386,7 +1324,11 @@ void opengl_error_print(std::string message) {
 	full_message += opengl_get_error_name(glGetError());
 	printf("%s\n", ("OpenGL error:" + full_message).c_str());
 }
+// glGetError waits for the driver, so only the sync level checks
 void assert_no_errors() {
+	if (validation != gl_validation::sync) {
+		return;
+	}
 	auto error = glGetError();
 	if (error != GL_NO_ERROR) {
 		auto message = opengl_get_error_name(error);
@@ -1503,41 +1445,14 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 	}
 }
 
-constexpr int triangle_size = 9;
-static std::vector<game::vertex> triangle_mesh = {
-	{{0.2f, 0.f, 0.5f}, {0.f, 0.f, 1.f}, {}},
-	{{0.f, 0.5f, 0.5f}, {0.f, 0.f, 1.f}, {}},
-	{{-0.2f, 0.f, 0.5f}, {0.f, 0.f, 1.f}, {}}
-};
-
-base_triangle create_triangle() {
-
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, triangle_mesh.size() * sizeof(game::vertex), triangle_mesh.data(), GL_STATIC_DRAW);
-
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(0));
-
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3));
-
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3 + sizeof(float) * 3));
-
-	return {vao, vbo};
+render::gpu_mesh create_triangle() {
+	render::mesh_data mesh;
+	render::add_triangle(mesh, {0.2f, 0.f, 0.5f}, {0.f, 0.5f, 0.5f}, {-0.2f, 0.f, 0.5f}, {0.f, 0.f, 1.f});
+	return render::upload_mesh(mesh);
 }
 
-static std::vector<game::vertex> tree_mesh;
-
-base_triangle create_tree() {
-	tree_mesh.clear();
+render::gpu_mesh create_tree() {
+	render::mesh_data mesh;
 	int quality = 4;
 	float angle_step = 2.f * glm::pi<float>() / (float)quality;
 
@@ -1552,37 +1467,14 @@ base_triangle create_tree() {
 		auto top_to_right = right_bottom - top;
 		auto normal = glm::cross(top_to_left, top_to_right);
 
-		tree_mesh.push_back({{left_bottom.x, left_bottom.y, left_bottom.z}, normal, {}});
-		tree_mesh.push_back({{right_bottom.x, right_bottom.y, right_bottom.z}, normal, {}});
-		tree_mesh.push_back({{top.x, top.y, top.z}, normal, {}});
+		render::add_triangle(mesh, left_bottom, right_bottom, top, normal);
 	}
 
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, tree_mesh.size() * sizeof(game::vertex), tree_mesh.data(), GL_STATIC_DRAW);
-
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(0));
-
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3));
-
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3 + sizeof(float) * 3));
-
-	return {vao, vbo};
+	return render::upload_mesh(mesh);
 }
 
-static std::vector<game::vertex> flower_mesh;
-
-base_triangle create_flower() {
-	flower_mesh.clear();
+render::gpu_mesh create_flower() {
+	render::mesh_data mesh;
 	int quality = 6;
 	float angle_step = 2.f * glm::pi<float>() / (float)quality;
 
@@ -1598,37 +1490,14 @@ base_triangle create_flower() {
 		auto top_to_right = right_bottom - top;
 		auto normal = glm::cross(top_to_left, top_to_right);
 
-		flower_mesh.push_back({{right_bottom.x, right_bottom.y, right_bottom.z}, normal, {}});
-		flower_mesh.push_back({{left_bottom.x, left_bottom.y, left_bottom.z}, normal, {}});
-		flower_mesh.push_back({{top.x, top.y, top.z}, normal, {}});
+		render::add_triangle(mesh, right_bottom, left_bottom, top, normal);
 	}
 
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, flower_mesh.size() * sizeof(game::vertex), flower_mesh.data(), GL_STATIC_DRAW);
-
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(0));
-
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3));
-
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3 + sizeof(float) * 3));
-
-	return {vao, vbo};
+	return render::upload_mesh(mesh);
 }
 
-static std::vector<game::vertex> flower_used_mesh;
-
-base_triangle create_used_flower() {
-	flower_used_mesh.clear();
+render::gpu_mesh create_used_flower() {
+	render::mesh_data mesh;
 	int quality = 6;
 	float angle_step = 2.f * glm::pi<float>() / (float)quality;
 
@@ -1643,144 +1512,340 @@ base_triangle create_used_flower() {
 		auto top_to_right = right_bottom - top;
 		auto normal = glm::cross(top_to_left, top_to_right);
 
-		flower_used_mesh.push_back({{left_bottom.x, left_bottom.y, left_bottom.z}, normal, {}});
-		flower_used_mesh.push_back({{right_bottom.x, right_bottom.y, right_bottom.z}, normal, {}});
-		flower_used_mesh.push_back({{top.x, top.y, top.z}, normal, {}});
+		render::add_triangle(mesh, left_bottom, right_bottom, top, normal);
 	}
 
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, flower_used_mesh.size() * sizeof(game::vertex), flower_used_mesh.data(), GL_STATIC_DRAW);
-
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(0));
-
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3));
+	return render::upload_mesh(mesh);
+}
 
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3 + sizeof(float) * 3));
+// greedy meshing: equal height tiles are merged into rectangles,
+// walls between the same pair of heights are merged into runs along the wall
+// positions are relative to the chunk origin
+// pure function of the snapshot: runs on worker threads
+// storage is an empty staging buffer which keeps its capacity from earlier chunks
+render::chunk_result build_chunk_mesh(render::chunk_heights const& data, render::mesh_data&& storage) {
+	auto chunk_x = data.chunk_x;
+	auto chunk_y = data.chunk_y;
+
+	render::chunk_result result {};
+	result.chunk_index = game::chunk_index(chunk_x, chunk_y);
+	result.generation = data.generation;
+	result.data = std::move(storage);
+	auto& mesh = result.data;
 
-	return {vao, vbo};
-}
+	glm::vec3 up = {0.f, 0.f, 1.f};
+	glm::vec3 n_left = {-1.f, 0.f, 0.f};
+	glm::vec3 n_forward = {0.f, -1.f, 0.f};
 
-void generate_mesh_from_heightmap(game::map_state& data, int chunk_x, int chunk_y) {
+	int base_x = chunk_x * game::CHUNK_SIZE;
+	int base_y = chunk_y * game::CHUNK_SIZE;
+	int world_min = -game::WORLD_RADIUS * game::CHUNK_SIZE;
+	int world_max = game::WORLD_RADIUS * game::CHUNK_SIZE;
 
-	auto chunk_index = (chunk_x + game::WORLD_RADIUS) * game::WORLD_SIZE + (chunk_y + game::WORLD_RADIUS);
+	auto height = [&](int ix, int iy) {
+		return (float)data.height[(ix + 1) * render::CHUNK_BORDERED_SIZE + (iy + 1)];
+	};
 
+	// tops
+	std::array<bool, game::CHUNK_AREA> used {};
+	for (int ix = 0; ix < game::CHUNK_SIZE; ix++) {
+		for (int iy = 0; iy < game::CHUNK_SIZE; iy++) {
+			if (used[ix * game::CHUNK_SIZE + iy]) {
+				continue;
+			}
+			auto z = height(ix, iy);
 
-	auto& mesh = data.meshes[chunk_index].data;
+			int size_y = 1;
+			while (
+				iy + size_y < game::CHUNK_SIZE
+				&& !used[ix * game::CHUNK_SIZE + iy + size_y]
+				&& height(ix, iy + size_y) == z
+			) {
+				size_y++;
+			}
 
-	glm::vec3 up = {0.f, 0.f, 1.f};
-	glm::vec3 n_left = {-1.f, 0.f, 0.f};
-	glm::vec3 n_forward = {0.f, -1.f, 0.f};
+			int size_x = 1;
+			while (ix + size_x < game::CHUNK_SIZE) {
+				bool same = true;
+				for (int k = 0; k < size_y; k++) {
+					if (used[(ix + size_x) * game::CHUNK_SIZE + iy + k] || height(ix + size_x, iy + k) != z) {
+						same = false;
+						break;
+					}
+				}
+				if (!same) {
+					break;
+				}
+				size_x++;
+			}
 
-	for (int i = 0; i < game::CHUNK_AREA; i++) {
-		int ix = i / game::CHUNK_SIZE;
-		int iy = i - ix * game::CHUNK_SIZE;
+			for (int a = 0; a < size_x; a++) {
+				for (int b = 0; b < size_y; b++) {
+					used[(ix + a) * game::CHUNK_SIZE + iy + b] = true;
+				}
+			}
 
-		float x = (float)ix + chunk_x * game::CHUNK_SIZE;
-		float y = (float)iy + chunk_y * game::CHUNK_SIZE;
-		float z = game::get_height(data, x, y);
+			float x = (float)ix;
+			float y = (float)iy;
+			float x1 = x + (float)size_x;
+			float y1 = y + (float)size_y;
 
-		mesh.push_back({{x, y, z}, up, {}});
-		mesh.push_back({{x + 1.f, y, z}, up, {}});
-		mesh.push_back({{x, y + 1.f, z}, up, {}});
+			render::add_quad(mesh, {x, y1, z}, {x, y, z}, {x1, y, z}, {x1, y1, z}, up);
+		}
+	}
 
-		mesh.push_back({{x, y + 1.f, z}, up, {}});
-		mesh.push_back({{x + 1.f, y, z}, up, {}});
-		mesh.push_back({{x + 1.f, y + 1.f, z}, up, {}});
+	// walls facing -x and +x, merged along y
+	for (int ix = 0; ix < game::CHUNK_SIZE; ix++) {
+		for (int side = -1; side <= 1; side += 2) {
+			int neighbour = base_x + ix + side;
+			if (neighbour < world_min || neighbour >= world_max) {
+				continue;
+			}
+			int iy = 0;
+			while (iy < game::CHUNK_SIZE) {
+				auto here = height(ix, iy);
+				auto there = height(ix + side, iy);
+				if (there >= here) {
+					iy++;
+					continue;
+				}
+				int length = 1;
+				while (
+					iy + length < game::CHUNK_SIZE
+					&& height(ix, iy + length) == here
+					&& height(ix + side, iy + length) == there
+				) {
+					length++;
+				}
 
-		auto here = (float)game::get_height(data, x, y);
-		if (x > -game::WORLD_RADIUS * game::CHUNK_SIZE) {
-			auto left = (float) game::get_height(data, x - 1, y);
-			if (left < here) {
-				float z_n = (float)(left);
+				float y = (float)iy;
+				float y1 = y + (float)length;
+				float z = here;
+				float z_n = there;
+				if (side < 0) {
+					float x = (float)ix;
+					render::add_quad(mesh, {x, y, z_n}, {x, y, z}, {x, y1, z}, {x, y1, z_n}, n_left);
+				} else {
+					float x = (float)(ix + 1);
+					render::add_quad(mesh, {x, y1, z}, {x, y, z}, {x, y, z_n}, {x, y1, z_n}, -n_left);
+				}
+				iy += length;
+			}
+		}
+	}
 
-				mesh.push_back({{x, y, z_n}, n_left, {}});
-				mesh.push_back({{x, y, z}, n_left, {}});
-				mesh.push_back({{x, y + 1.f, z}, n_left, {}});
+	// walls facing -y and +y, merged along x
+	for (int iy = 0; iy < game::CHUNK_SIZE; iy++) {
+		for (int side = -1; side <= 1; side += 2) {
+			int neighbour = base_y + iy + side;
+			if (neighbour < world_min || neighbour >= world_max) {
+				continue;
+			}
+			int ix = 0;
+			while (ix < game::CHUNK_SIZE) {
+				auto here = height(ix, iy);
+				auto there = height(ix, iy + side);
+				if (there >= here) {
+					ix++;
+					continue;
+				}
+				int length = 1;
+				while (
+					ix + length < game::CHUNK_SIZE
+					&& height(ix + length, iy) == here
+					&& height(ix + length, iy + side) == there
+				) {
+					length++;
+				}
 
-				mesh.push_back({{x, y, z_n}, n_left, {}});
-				mesh.push_back({{x, y + 1.f, z}, n_left, {}});
-				mesh.push_back({{x, y + 1.f, z_n}, n_left, {}});
+				float x = (float)ix;
+				float x1 = x + (float)length;
+				float z = here;
+				float z_n = there;
+				if (side < 0) {
+					float y = (float)iy;
+					render::add_quad(mesh, {x1, y, z}, {x, y, z}, {x, y, z_n}, {x1, y, z_n}, n_forward);
+				} else {
+					float y = (float)(iy + 1);
+					render::add_quad(mesh, {x, y, z_n}, {x, y, z}, {x1, y, z}, {x1, y, z_n}, -n_forward);
+				}
+				ix += length;
 			}
 		}
+	}
 
-		if (x + 1 < game::WORLD_RADIUS * game::CHUNK_SIZE) {
-			auto there = (float)game::get_height(data, x + 1, y);
-			if (there < here) {
-				float z_n = (float)(there);
 
-				mesh.push_back({{x + 1.f, y, z}, -n_left, {}});
-				mesh.push_back({{x + 1.f, y, z_n}, -n_left, {}});
-				mesh.push_back({{x + 1.f, y + 1.f, z}, -n_left, {}});
+	float min_z = std::numeric_limits<float>::max();
+	float max_z = -std::numeric_limits<float>::max();
+	// walls reach down to the neighbouring tiles
+	for (int ix = -1; ix <= game::CHUNK_SIZE; ix++) {
+		for (int iy = -1; iy <= game::CHUNK_SIZE; iy++) {
+			if (
+				base_x + ix < world_min || base_x + ix >= world_max
+				|| base_y + iy < world_min || base_y + iy >= world_max
+			) {
+				continue;
+			}
+			min_z = std::min(min_z, height(ix, iy));
+			max_z = std::max(max_z, height(ix, iy));
+		}
+	}
+	result.bounds = {
+		{(float)base_x, (float)base_y, min_z},
+		{(float)(base_x + game::CHUNK_SIZE), (float)(base_y + game::CHUNK_SIZE), max_z}
+	};
+	return result;
+}
 
-				mesh.push_back({{x + 1.f, y + 1.f, z}, -n_left, {}});
-				mesh.push_back({{x + 1.f, y, z_n}, -n_left, {}});
-				mesh.push_back({{x + 1.f, y + 1.f, z_n}, -n_left, {}});
+namespace render {
+
+chunk_heights snapshot_chunk(game::map_state& map, int chunk_x, int chunk_y) {
+	chunk_heights result {};
+	result.chunk_x = chunk_x;
+	result.chunk_y = chunk_y;
+
+	int base_x = chunk_x * game::CHUNK_SIZE;
+	int base_y = chunk_y * game::CHUNK_SIZE;
+	int world_min = -game::WORLD_RADIUS * game::CHUNK_SIZE;
+	int world_max = game::WORLD_RADIUS * game::CHUNK_SIZE;
+
+	for (int ix = -1; ix <= game::CHUNK_SIZE; ix++) {
+		for (int iy = -1; iy <= game::CHUNK_SIZE; iy++) {
+			int x = base_x + ix;
+			int y = base_y + iy;
+			// tiles outside of the world are never read by the mesher
+			if (x < world_min || x >= world_max || y < world_min || y >= world_max) {
+				continue;
 			}
+			result.height[(ix + 1) * CHUNK_BORDERED_SIZE + (iy + 1)] = game::get_height(map, x, y);
 		}
+	}
+	return result;
+}
 
-		if (y > -game::WORLD_RADIUS * game::CHUNK_SIZE) {
-			auto there = (float)game::get_height(data, x, y - 1);
-			if (there < here) {
-				float z_n = (float)(there);
+void request_chunk_mesh(state& data, game::map_state& map, int chunk_x, int chunk_y) {
+	auto snapshot = snapshot_chunk(map, chunk_x, chunk_y);
+	snapshot.generation = ++data.generation[game::chunk_index(chunk_x, chunk_y)];
+	data.meshing_in_flight++;
 
+	mesh_data storage;
+	if (!data.staging.empty()) {
+		storage = std::move(data.staging.back());
+		data.staging.pop_back();
+	}
 
-				mesh.push_back({{x, y, z}, n_forward, {}});
-				mesh.push_back({{x, y, z_n}, n_forward, {}});
-				mesh.push_back({{x + 1.f, y, z}, n_forward, {}});
+	jobs::submit(data.workers, [&data, snapshot, storage = std::move(storage)]() mutable {
+		auto result = build_chunk_mesh(snapshot, std::move(storage));
+		std::lock_guard lock {data.ready_mutex};
+		data.ready.push_back(std::move(result));
+	});
+}
 
-				mesh.push_back({{x + 1.f, y, z}, n_forward, {}});
-				mesh.push_back({{x, y, z_n}, n_forward, {}});
-				mesh.push_back({{x + 1.f, y, z_n}, n_forward, {}});
+// main thread only: creates or refills the buffers of finished chunks
+void upload_ready_chunks(state& data, int budget) {
+	std::vector<chunk_result> batch;
+	{
+		std::lock_guard lock {data.ready_mutex};
+		auto count = std::min((size_t)budget, data.ready.size());
+		std::move(data.ready.begin(), data.ready.begin() + count, std::back_inserter(batch));
+		data.ready.erase(data.ready.begin(), data.ready.begin() + count);
+	}
+
+	for (auto& result : batch) {
+		data.meshing_in_flight--;
+		if (result.generation == data.generation[result.chunk_index]) {
+			auto& chunk = data.meshes[result.chunk_index];
+			auto& arena = data.terrain;
+			if (chunk.uploaded) {
+				arena_free(arena.vertices, chunk.first_vertex, chunk.vertices_count);
+				arena_free(arena.indices, chunk.first_index, chunk.indices_count);
 			}
-		}
+			chunk.vertices_count = (uint32_t)result.data.vertices.size();
+			chunk.indices_count = (uint32_t)result.data.indices.size();
+			chunk.first_vertex = allocate_vertices(arena, chunk.vertices_count);
+			chunk.first_index = allocate_indices(arena, chunk.indices_count);
+			chunk.bounds = result.bounds;
+			chunk.uploaded = true;
+			data.shadows.static_version++;
+
+			chunk_record record {
+				glm::vec4(chunk.bounds.min, 0.f), glm::vec4(chunk.bounds.max, 0.f),
+				chunk.indices_count, chunk.first_index, (GLint)chunk.first_vertex, 1
+			};
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, data.culling.chunks);
+			glBufferSubData(
+				GL_SHADER_STORAGE_BUFFER, (size_t)result.chunk_index * sizeof(chunk_record), sizeof(chunk_record), &record
+			);
 
-		if (y + 1 < game::WORLD_RADIUS * game::CHUNK_SIZE) {
-			auto there = (float)game::get_height(data, x, y + 1);
-			if (there < here) {
-				float z_n = (float)(there);
+			glBindBuffer(GL_ARRAY_BUFFER, arena.vbo);
+			glBufferSubData(
+				GL_ARRAY_BUFFER,
+				(size_t)chunk.first_vertex * sizeof(vertex), chunk.vertices_count * sizeof(vertex),
+				result.data.vertices.data()
+			);
+			glBindBuffer(GL_ARRAY_BUFFER, arena.ebo);
+			glBufferSubData(
+				GL_ARRAY_BUFFER,
+				(size_t)chunk.first_index * sizeof(index), chunk.indices_count * sizeof(index),
+				result.data.indices.data()
+			);
+		}
 
-				mesh.push_back({{x, y + 1.f, z_n}, -n_forward, {}});
-				mesh.push_back({{x, y + 1.f, z}, -n_forward, {}});
-				mesh.push_back({{x + 1.f, y + 1.f, z}, -n_forward, {}});
+		if (data.staging.size() < STAGING_POOL_SIZE) {
+			result.data.vertices.clear();
+			result.data.indices.clear();
+			data.staging.push_back(std::move(result.data));
+		}
+	}
+}
 
-				mesh.push_back({{x, y + 1.f, z_n}, -n_forward, {}});
-				mesh.push_back({{x + 1.f, y + 1.f, z}, -n_forward, {}});
-				mesh.push_back({{x + 1.f, y + 1.f, z_n}, -n_forward, {}});
-			}
+// one indirect draw for every chunk which passes the test, returns the number of chunks
+int draw_terrain(state& data, frustum const& view) {
+	auto& arena = data.terrain;
+	arena.draws.clear();
+	for (int i = 0; i < game::WORLD_AREA; i++) {
+		auto& chunk = data.meshes[i];
+		if (!chunk.uploaded || !intersects(view, chunk.bounds)) {
+			continue;
 		}
+		arena.draws.push_back({
+			chunk.indices_count,
+			1,
+			chunk.first_index,
+			(GLint)chunk.first_vertex,
+			(GLuint)i
+		});
 	}
 
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, mesh.size() * sizeof(game::vertex), mesh.data(), GL_STATIC_DRAW);
+	if (arena.draws.empty()) {
+		return 0;
+	}
 
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arena.commands);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, arena.draws.size() * sizeof(draw_elements_command), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, arena.draws.size() * sizeof(draw_elements_command), arena.draws.data());
 
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(0));
+	glBindVertexArray(arena.vao);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, INDEX_TYPE, nullptr, (GLsizei)arena.draws.size(), 0);
 
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3));
+	uint64_t vertices = 0;
+	for (auto& draw : arena.draws) {
+		vertices += draw.count;
+	}
+	count_state_changes(data, 2);
+	count_draw(data, vertices);
+	return (int)arena.draws.size();
+}
 
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(game::vertex),  reinterpret_cast<void*>(sizeof(float) * 3 + sizeof(float) * 3));
+// one command per chunk, culled ones have no instances
+void draw_terrain_culled(state& data) {
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, data.culling.chunk_commands);
+	glBindVertexArray(data.terrain.vao);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, INDEX_TYPE, nullptr, game::WORLD_AREA, 0);
+	count_state_changes(data, 2);
+	count_draw(data, 0);
+}
 
-	data.meshes[chunk_index].vao = vao;
-	data.meshes[chunk_index].vbo = vbo;
 }
 
 
@@ -1834,9 +1899,24 @@ void render_triangle(
 }
 
 game::state world {};
+render::state renderer {};
 
-int main(void)
+int main(int argc, char** argv)
 {
+	const char* world_path = nullptr;
+	for (int i = 1; i < argc; i++) {
+		std::string_view argument = argv[i];
+		if (argument == "--gl-validation=off") {
+			validation = gl_validation::off;
+		} else if (argument == "--gl-validation=async") {
+			validation = gl_validation::async;
+		} else if (argument == "--gl-validation=sync") {
+			validation = gl_validation::sync;
+		} else if (argument.starts_with("--world=")) {
+			world_path = argv[i] + argument.find('=') + 1;
+		}
+	}
+
 	glfwSetErrorCallback(error_callback);
 	if (!glfwInit())
 		return -1;
@@ -1844,7 +1924,7 @@ int main(void)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, validation != gl_validation::off);
 
 	GLFWwindow* window;
 	float main_scale = ImGui_ImplGlfw_GetContentScaleForMonitor(glfwGetPrimaryMonitor());
@@ -1888,11 +1968,10 @@ int main(void)
 	// GLEW validation
 	if (auto result = glewInit(); result != GLEW_NO_ERROR)
 		glew_fail("glewInit: ", result);
-	if (!GLEW_VERSION_3_3)
-		throw std::runtime_error("OpenGL 3.3 is not supported");
+	if (!GLEW_VERSION_4_3)
+		throw std::runtime_error("OpenGL 4.3 is not supported");
 
-	glEnable(GL_DEBUG_OUTPUT);
-	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	setup_gl_validation();
 
 	// illumination settings
 	glm::vec3 light_color = glm::vec3(1.f, 0.8f, 0.3f);
@@ -1938,6 +2017,7 @@ int main(void)
 	GLuint view_location = glGetUniformLocation(basic_shader, "view");
 	GLuint projection_location = glGetUniformLocation(basic_shader, "projection");
 	GLuint albedo_location = glGetUniformLocation(basic_shader, "albedo");
+	GLuint albedo_soul_location = glGetUniformLocation(basic_shader, "albedo_soul");
 	GLuint color_location = glGetUniformLocation(basic_shader, "color");
 	GLuint use_texture_location = glGetUniformLocation(basic_shader, "use_texture");
 	GLuint light_direction_location = glGetUniformLocation(basic_shader, "light_direction");
@@ -1949,6 +2029,7 @@ int main(void)
 	GLuint shadow_layers_location = glGetUniformLocation(basic_shader, "shadow_layers");
 	GLuint shadow_map_location = glGetUniformLocation(basic_shader, "shadow_map");
 	GLuint render_shadow_transform_location = glGetUniformLocation(basic_shader, "shadow_transform");
+	GLuint evsm_exponent_location = glGetUniformLocation(basic_shader, "evsm_exponent");
 
 
 	std::string shadow_vertex_path = "./shaders/shadow.vert";
@@ -1960,9 +2041,35 @@ int main(void)
 	auto shadow_program = create_program(shadow_vertex_shader, shadow_fragment_shader);
 	GLuint shadow_model_location = glGetUniformLocation(shadow_program, "model");
 	GLuint shadow_transform_location = glGetUniformLocation(shadow_program, "transform");
+	GLuint shadow_evsm_exponent_location = glGetUniformLocation(shadow_program, "evsm_exponent");
+
+	std::string fullscreen_vertex_source = read_shader("./shaders/fullscreen.vert");
+	std::string shadow_blur_fragment_source = read_shader("./shaders/shadow_blur.frag");
+	auto shadow_blur_program = create_program(
+		create_shader(GL_VERTEX_SHADER, fullscreen_vertex_source.c_str()),
+		create_shader(GL_FRAGMENT_SHADER, shadow_blur_fragment_source.c_str())
+	);
+
+	std::string post_fragment_source = read_shader("./shaders/post.frag");
+	render::init_post_process(
+		renderer.post,
+		create_program(
+			create_shader(GL_VERTEX_SHADER, fullscreen_vertex_source.c_str()),
+			create_shader(GL_FRAGMENT_SHADER, post_fragment_source.c_str())
+		)
+	);
+	render::init_gpu_timers(renderer.timers);
+
+	std::string cull_chunks_source = read_shader("./shaders/cull_chunks.comp");
+	std::string cull_things_source = read_shader("./shaders/cull_things.comp");
+	render::init_gpu_culling(
+		renderer.culling,
+		create_program(create_shader(GL_COMPUTE_SHADER, cull_chunks_source.c_str())),
+		create_program(create_shader(GL_COMPUTE_SHADER, cull_things_source.c_str()))
+	);
 
 	GLsizei shadow_map_resolution = 2048;
-	const GLsizei shadow_layers = 1;
+	const GLsizei shadow_layers = render::SHADOW_CASCADES;
 
 	GLuint shadow_map;
 	glGenTextures(1, &shadow_map);
@@ -1971,14 +2078,7 @@ int main(void)
 	glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage3D(
-		GL_TEXTURE_2D_ARRAY,
-		0,
-		GL_RG32F,
-		shadow_map_resolution, shadow_map_resolution, shadow_layers,
-		0,
-		GL_RGBA, GL_FLOAT, nullptr
-	);
+	render::init_shadow_cache(renderer.shadows, shadow_map, shadow_map_resolution, shadow_blur_program);
 
 	GLuint shadow_fbo [shadow_layers];
 	GLuint shadow_renderbuffers [shadow_layers];
@@ -2005,6 +2105,9 @@ int main(void)
 	float albedo_character[] = {0.9f, 0.5f, 0.6f};
 	float albedo_critter[] = {0.5f, 0.1f, 0.1f};
 
+	// terrain has no souls
+	glVertexAttrib1f(4, 0.f);
+
 
 	std::default_random_engine rng;
 	std::uniform_real_distribution<float> uniform{0.0, 1.0};
@@ -2019,39 +2122,36 @@ int main(void)
 
 	assert_no_errors();
 
-	game::init(world);
-
-
-	world.data.kind_set_vao(world.special_kinds.human, triangle.vao);
-	world.data.kind_set_vao(world.special_kinds.meatbug, triangle.vao);
-	world.data.kind_set_vao(world.special_kinds.meatbug_queen, triangle.vao);
-	world.data.kind_set_vao(world.special_kinds.tree, tree.vao);
-	world.data.kind_set_vao(world.special_kinds.meatflower, flower.vao);
-	world.data.kind_set_dead_vao(world.special_kinds.meatflower, dead_flower.vao);
-
-	world.data.kind_set_triangles_count(world.special_kinds.human, triangle_mesh.size());
-	world.data.kind_set_triangles_count(world.special_kinds.meatbug, triangle_mesh.size());
-	world.data.kind_set_triangles_count(world.special_kinds.meatbug_queen, triangle_mesh.size());
-	world.data.kind_set_triangles_count(world.special_kinds.tree, tree_mesh.size());
-	world.data.kind_set_triangles_count(world.special_kinds.meatflower, flower_mesh.size());
-
-	for (int i = 0; i < game::WORLD_AREA_TILES; i++) {
-		world.map.height[i] = 0;
+	if (world_path) {
+		world_image::mapping image;
+		if (!world_image::open(image, world_path) || !world_image::load(world, image)) {
+			fprintf(stderr, "failed to load world image %s\n", world_path);
+			return -1;
+		}
+	} else {
+		game::init(world);
 	}
-	world.data.for_each_building([&](auto data) {
-		auto x = world.data.building_get_tile_x(data);
-		auto y = world.data.building_get_tile_y(data);
+	events::start(world.events);
 
-		game::set_height(world.map, x, y, 1);
-	});
 
+	render::set_kind_mesh(renderer, world.special_kinds.human, triangle, triangle);
+	render::set_kind_mesh(renderer, world.special_kinds.meatbug, triangle, triangle);
+	render::set_kind_mesh(renderer, world.special_kinds.meatbug_queen, triangle, triangle);
+	render::set_kind_mesh(renderer, world.special_kinds.tree, tree, tree, true);
+	render::set_kind_mesh(renderer, world.special_kinds.meatflower, flower, dead_flower);
+
+	// the world shows up chunk by chunk while the workers mesh it
+	render::init_terrain_arena(renderer.terrain);
+	jobs::start(renderer.workers);
 	for (int i = 0; i < game::WORLD_AREA; i++) {
 		auto x = i / game::WORLD_SIZE;
 		auto y = i - x * game::WORLD_SIZE;
 		x -= game::WORLD_RADIUS;
 		y -= game::WORLD_RADIUS;
-		generate_mesh_from_heightmap(world.map, x, y);
+		render::request_chunk_mesh(renderer, world.map, x, y);
 	}
+	game::clear_dirty_chunks(world.map);
+	render::update_instances(renderer, world);
 
 
 	float update_timer = 0.f;
@@ -2077,6 +2177,15 @@ int main(void)
 		if (update_timer > 1.f / 60.f) {
 			update_timer = 0.f;
 			game::update(world);
+			render::update_instances(renderer, world);
+		}
+
+		{
+			int chunk_x, chunk_y;
+			for (int i = 0; i < render::REMESH_BUDGET && game::pop_dirty_chunk(world.map, chunk_x, chunk_y); i++) {
+				render::request_chunk_mesh(renderer, world.map, chunk_x, chunk_y);
+			}
+			render::upload_ready_chunks(renderer, render::UPLOAD_BUDGET);
 		}
 
 		camera_speed *= exp(-dt * 10.f);
@@ -2089,6 +2198,8 @@ int main(void)
 		// 	continue;
 		// }
 
+		render::collect_gpu_timers(renderer, world.profile);
+
 		// Start the Dear ImGui frame
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
@@ -2098,7 +2209,7 @@ int main(void)
 		const float TEXT_BASE_HEIGHT = ImGui::GetTextLineHeightWithSpacing();
 
 		glm::vec3 light_direction {cosf(time / 100.f), sinf(time / 100.f), 2.5f};
-		glm::vec3 light_z = glm::normalize(light_direction);
+		glm::vec3 light_z = render::shadow_light_direction(renderer.shadows, light_direction);
 		glm::vec3 light_x = glm::normalize(glm::cross(light_z, {0.f, 0.f, 1.f}));
 		glm::vec3 light_y = glm::cross(light_x, light_z);
 
@@ -2131,6 +2242,87 @@ int main(void)
 			});
 			ImGui::Begin("Stats");
 			ImGui::Text("Total debt: %f", total_debt);
+			if (ImGui::Checkbox("GPU culling", &renderer.culling.enabled) && renderer.culling.enabled) {
+				render::upload_culling_inputs(renderer);
+			}
+			if (!renderer.culling.enabled) {
+				ImGui::Text("Chunks drawn: %d, in shadows: %d", renderer.visible_chunks, renderer.shadow_chunks);
+			}
+			ImGui::Text("Shadow cascades rendered again: %d", renderer.shadows.refreshed);
+			if (ImGui::Checkbox("Half precision shadows (EVSM)", &renderer.shadows.half_precision)) {
+				render::allocate_shadow_storage(renderer.shadows);
+			}
+			ImGui::Text("Chunks waiting for remeshing: %d, meshing: %d", (int)world.map.dirty_chunks.size(), renderer.meshing_in_flight);
+			ImGui::End();
+		}
+
+		{
+			ImGui::Begin("Profiler");
+
+			ImGui::Checkbox("Record trace", &world.profile.record_trace);
+			ImGui::SameLine();
+			if (ImGui::Button("Dump trace")) {
+				if (!profiler::dump_chrome_trace(world.profile, "trace.json")) {
+					printf("Failed to write trace.json\n");
+				}
+			}
+			ImGui::Checkbox("Parallel AI", &world.parallel_ai);
+
+			if (ImGui::BeginTable("profiler_phases", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV)) {
+				ImGui::TableSetupColumn("Phase");
+				ImGui::TableSetupColumn("Min ms");
+				ImGui::TableSetupColumn("Avg ms");
+				ImGui::TableSetupColumn("P99 ms");
+				ImGui::TableHeadersRow();
+
+				for (size_t i = 0; i < profiler::CPU_PHASES_COUNT; i++) {
+					auto what = (profiler::phase)i;
+					auto stats = profiler::get_stats(world.profile, what);
+					ImGui::TableNextRow();
+					ImGui::TableSetColumnIndex(0);
+					ImGui::Text("%s", profiler::get_name(what));
+					ImGui::TableSetColumnIndex(1);
+					ImGui::Text("%.4f", stats.min_ms);
+					ImGui::TableSetColumnIndex(2);
+					ImGui::Text("%.4f", stats.avg_ms);
+					ImGui::TableSetColumnIndex(3);
+					ImGui::Text("%.4f", stats.p99_ms);
+				}
+				ImGui::EndTable();
+			}
+
+			// render passes are reported GPU_TIMER_FRAMES frames after they ran
+			ImGui::Text("GPU samples dropped: %d", (int)renderer.timers.dropped);
+			if (ImGui::BeginTable("profiler_passes", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV)) {
+				ImGui::TableSetupColumn("Pass");
+				ImGui::TableSetupColumn("Avg ms");
+				ImGui::TableSetupColumn("P99 ms");
+				ImGui::TableSetupColumn("Draws");
+				ImGui::TableSetupColumn("State changes");
+				ImGui::TableSetupColumn("Vertices");
+				ImGui::TableHeadersRow();
+
+				for (size_t i = profiler::CPU_PHASES_COUNT; i < profiler::PHASES_COUNT; i++) {
+					auto what = (profiler::phase)i;
+					auto stats = profiler::get_stats(world.profile, what);
+					auto& counters = renderer.timers.last[render::pass_index(what)];
+					ImGui::TableNextRow();
+					ImGui::TableSetColumnIndex(0);
+					ImGui::Text("%s", profiler::get_name(what));
+					ImGui::TableSetColumnIndex(1);
+					ImGui::Text("%.4f", stats.avg_ms);
+					ImGui::TableSetColumnIndex(2);
+					ImGui::Text("%.4f", stats.p99_ms);
+					ImGui::TableSetColumnIndex(3);
+					ImGui::Text("%u", counters.draws);
+					ImGui::TableSetColumnIndex(4);
+					ImGui::Text("%u", counters.state_changes);
+					ImGui::TableSetColumnIndex(5);
+					ImGui::Text("%llu", (unsigned long long)counters.vertices);
+				}
+				ImGui::EndTable();
+			}
+
 			ImGui::End();
 		}
 
@@ -2191,10 +2383,28 @@ int main(void)
 			ImGui::End();
 		}
 
+		{
+			static std::vector<events::event> recent_events;
+			events::recent(world.events, recent_events);
+
+			ImGui::Begin("Events");
+			ImGui::Text("Dropped: %zu", world.events.dropped.load());
+
+			// newest first, only visible rows are turned into text
+			ImGuiListClipper clipper;
+			clipper.Begin((int)recent_events.size());
+			while (clipper.Step()) {
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+					auto& item = recent_events[recent_events.size() - 1 - i];
+					ImGui::TextUnformatted(game::describe(world, item).c_str());
+				}
+			}
 
-		ImGui::Render();
+			ImGui::End();
+		}
 
 
+		ImGui::Render();
 
 		float near_plane = 0.1f;
 		float far_plane = 20.f;
@@ -2221,6 +2431,9 @@ int main(void)
 			}
 		}
 
+		render::begin_pass(renderer, profiler::phase::gpu_shadows);
+		renderer.shadow_chunks = 0;
+		renderer.shadows.refreshed = 0;
 		for (GLsizei i = 0; i < shadow_layers; i++) {
 			float ratio = far_plane / near_plane;
 			float current_layer_ratio = (float) i / shadow_layers;
@@ -2236,8 +2449,6 @@ int main(void)
 			auto visible_world = frustum(projection_shadow_range * view).vertices;
 
 
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadow_fbo[i]);
-
 			glEnable(GL_DEPTH_TEST);
 			glDepthFunc(GL_LEQUAL);
 
@@ -2248,10 +2459,10 @@ int main(void)
 
 			glDisable(GL_BLEND);
 
-			glClearColor(1.0f, 1.0f, 0.0f, 0.0f);
+			auto empty_moments = render::empty_moments(renderer.shadows);
+			glClearColor(empty_moments.x, empty_moments.y, 0.0f, 0.0f);
 			glClearDepth(1.0f);
 
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			glViewport(0, 0, shadow_map_resolution, shadow_map_resolution);
 
 			// projection of corners on X
@@ -2294,6 +2505,20 @@ int main(void)
 			min_z = std::min(min_z, glm::dot(corner, light_z));
 */
 
+			// a square of a power of two size around the slice, moving in whole steps:
+			// the projection and the cached static shadows survive small camera moves
+			float size = exp2(ceil(log2(std::max(max_x - min_x, max_y - min_y) * 1.5f)));
+			float step = size / render::SHADOW_SNAP_STEPS;
+			float snapped_x = floor((min_x + max_x) * 0.5f / step) * step;
+			float snapped_y = floor((min_y + max_y) * 0.5f / step) * step;
+			min_x = snapped_x - size * 0.5f;
+			max_x = snapped_x + size * 0.5f;
+			min_y = snapped_y - size * 0.5f;
+			max_y = snapped_y + size * 0.5f;
+			// casters between the slice and the light are kept
+			min_z = floor(min_z / step) * step;
+			max_z = ceil(max_z / step) * step + render::SHADOW_CASTER_DISTANCE;
+
 			glm::vec3 max = {max_x, max_y, max_z};
 			glm::vec3 min = {min_x, min_y, min_z};
 
@@ -2322,56 +2547,63 @@ int main(void)
 
 			// projection_full_range = light_projection;
 
+			if (renderer.culling.enabled) {
+				render::cull_on_gpu(renderer, light_projection);
+			}
+
 			glUseProgram(shadow_program);
+			render::count_state_changes(renderer);
 			glm::mat4 model (1.f);
 			glUniformMatrix4fv(shadow_model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
 			glUniformMatrix4fv(shadow_transform_location, 1, GL_FALSE, reinterpret_cast<float *>(&light_projection));
-
-			for (auto & ch : world.map.meshes) {
-				glBindVertexArray(ch.vao);
-				glDrawArrays(
-					GL_TRIANGLES,
-					0,
-					ch.data.size()
-				);
-			}
-			world.data.for_each_thing([&] (dcon::thing_id cid) {
-				auto soul = world.data.thing_get_embodier_from_embodiment(cid);
-				auto guest_in = world.data.thing_get_guest_location_from_guest(cid);
-				if(guest_in) {
-					return;
-				}
-				glm::mat4 model (1.f);
-				model = glm::translate(model, {world.data.thing_get_x(cid), world.data.thing_get_y(cid), 0.f});
-
-				auto kind = world.data.thing_get_kind(cid);
-				auto size = world.data.kind_get_size(kind);
-				model = glm::scale(model, {size, size, 1.f});
-				auto rotation = world.data.thing_get_direction(cid);
-				model = glm::rotate(model, rotation, glm::vec3{0.f, 0.f, 1.f});
-				glUniformMatrix4fv(shadow_model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-				auto hp = world.data.thing_get_hp(cid);
-				if (hp > 0) {
-					glBindVertexArray(world.data.kind_get_vao(kind));
+			glUniform1f(shadow_evsm_exponent_location, render::evsm_exponent(renderer.shadows));
+
+			// casters outside of the light space box of the cascade are culled
+			if (render::shadow_cascade_stale(renderer.shadows, i, light_projection)) {
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer.shadows.static_fbo[i]);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				render::count_state_changes(renderer);
+				if (renderer.culling.enabled) {
+					render::draw_terrain_culled(renderer);
+					render::draw_things_culled(renderer, render::things_filter::static_only);
 				} else {
-					glBindVertexArray(world.data.kind_get_dead_vao(kind));
+					frustum light_frustum(light_projection);
+					renderer.shadow_chunks += render::draw_terrain(renderer, light_frustum);
+					render::draw_things(renderer, render::things_filter::static_only);
 				}
-				glDrawArrays(
-					GL_TRIANGLES,
-					0,
-					world.data.kind_get_triangles_count(kind)
-				);
-			});
+				renderer.shadows.projections[i] = light_projection;
+				renderer.shadows.versions[i] = renderer.shadows.static_version;
+				renderer.shadows.refreshed++;
+			}
+
+			render::restore_static_shadows(renderer.shadows, i, shadow_renderbuffers[i]);
+
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadow_fbo[i]);
+			render::count_state_changes(renderer);
+			if (renderer.culling.enabled) {
+				render::draw_things_culled(renderer, render::things_filter::dynamic_only);
+			} else {
+				render::draw_things(renderer, render::things_filter::dynamic_only);
+			}
 		}
 
+		render::end_pass(renderer);
+
+		render::begin_pass(renderer, profiler::phase::gpu_shadow_blur);
+		render::blur_shadows(renderer, shadow_fbo);
+		render::end_pass(renderer);
+
 		assert_no_errors();
 
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 		glfwGetFramebufferSize(window, &width, &height);
 
 		width = std::max(width, 10);
 		height = std::max(height, 10);
 
+		render::begin_pass(renderer, profiler::phase::gpu_terrain);
+		render::resize_post_process(renderer.post, width, height);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer.post.fbo);
+
 		glViewport(0, 0, width, height);
 		float aspect_ratio = (float) width / (float) height;
 		glClearColor(ambient.x, ambient.y, ambient.z, 0.f);
@@ -2389,11 +2621,15 @@ int main(void)
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+		if (renderer.culling.enabled) {
+			render::cull_on_gpu(renderer, projection_full_range * view);
+		}
+
 		glUseProgram(basic_shader);
 
 		glActiveTexture(GL_TEXTURE10);
 		glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
-		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		render::count_state_changes(renderer, 3);
 
 		glm::mat4 model (1.f);
 		glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
@@ -2405,63 +2641,54 @@ int main(void)
 		glUniform3fv(ambient_location, 1,  reinterpret_cast<float *>(&ambient));
 
 		glUniform3fv(albedo_location, 1, albedo_world);
+		glUniform3fv(albedo_soul_location, 1, albedo_world);
 
 		glUniform1i(shadow_map_location, 10);
 		glUniform1i(shadow_layers_location, shadow_layers);
+		glUniform1f(evsm_exponent_location, render::evsm_exponent(renderer.shadows));
 		glUniformMatrix4fv(render_shadow_transform_location, shadow_layers, GL_FALSE, reinterpret_cast<float *>(shadow_projections.data()));
 
 		assert_no_errors();
 
-		for (auto & ch : world.map.meshes) {
-			glBindVertexArray(ch.vao);
-			glDrawArrays(
-				GL_TRIANGLES,
-				0,
-				ch.data.size()
-			);
+		if (renderer.culling.enabled) {
+			render::draw_terrain_culled(renderer);
+		} else {
+			frustum camera_frustum(projection_full_range * view);
+			renderer.visible_chunks = render::draw_terrain(renderer, camera_frustum);
 		}
 
+		render::end_pass(renderer);
+
 		assert_no_errors();
 
-		world.data.for_each_thing([&] (dcon::thing_id cid) {
-			auto soul = world.data.thing_get_embodier_from_embodiment(cid);
-			auto guest_in = world.data.thing_get_guest_location_from_guest(cid);
-			if(guest_in) {
-				return;
-			}
-			glm::mat4 model (1.f);
-			model = glm::translate(model, {world.data.thing_get_x(cid), world.data.thing_get_y(cid), 0.f});
-			if (!soul) {
-				glUniform3fv(albedo_location, 1, albedo_critter);
-			} else {
-				glUniform3fv(albedo_location, 1, albedo_character);
-			}
+		render::begin_pass(renderer, profiler::phase::gpu_things);
+		glUniform3fv(albedo_location, 1, albedo_critter);
+		glUniform3fv(albedo_soul_location, 1, albedo_character);
+		if (renderer.culling.enabled) {
+			render::draw_things_culled(renderer);
+		} else {
+			render::draw_things(renderer);
+		}
 
-			auto kind = world.data.thing_get_kind(cid);
-			auto size = world.data.kind_get_size(kind);
-			model = glm::scale(model, {size, size, 1.f});
-			auto rotation = world.data.thing_get_direction(cid);
-			model = glm::rotate(model, rotation, glm::vec3{0.f, 0.f, 1.f});
-			glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-			auto hp = world.data.thing_get_hp(cid);
-			if (hp > 0) {
-				glBindVertexArray(world.data.kind_get_vao(kind));
-			} else {
-				glBindVertexArray(world.data.kind_get_dead_vao(kind));
-			}
-			glDrawArrays(
-				GL_TRIANGLES,
-				0,
-				world.data.kind_get_triangles_count(kind)
-			);
-		});
+		render::end_pass(renderer);
 
+		render::begin_pass(renderer, profiler::phase::gpu_post);
+		render::apply_post_process(renderer, projection_full_range, ambient);
+		render::end_pass(renderer);
 
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		render::begin_pass(renderer, profiler::phase::gpu_imgui);
+		auto draw_data = ImGui::GetDrawData();
+		ImGui_ImplOpenGL3_RenderDrawData(draw_data);
+		for (int i = 0; i < draw_data->CmdListsCount; i++) {
+			renderer.timers.current.draws += draw_data->CmdLists[i]->CmdBuffer.Size;
+		}
+		renderer.timers.current.vertices += draw_data->TotalIdxCount;
+		render::end_pass(renderer);
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 		assert_no_errors();
+		print_gl_messages();
 	}
 
 	// Cleanup
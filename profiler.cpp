@@ -0,0 +1,161 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace profiler {
+
+void record_trace(state& data, phase what, clock::time_point start, clock::time_point end, pass_counters const& counters = {}) {
+	trace_event event {
+		std::chrono::duration_cast<std::chrono::microseconds>(start - data.origin).count(),
+		std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+		data.tick,
+		what,
+		counters
+	};
+
+	if (data.trace.size() < TRACE_CAPACITY) {
+		data.trace.push_back(event);
+	} else {
+		data.trace[data.trace_next] = event;
+	}
+	data.trace_next = (data.trace_next + 1) % TRACE_CAPACITY;
+}
+
+void add_sample(state& data, phase what, float duration) {
+	auto& h = data.phases[(size_t)what];
+	h.samples_ms[h.next] = duration;
+	h.next = (h.next + 1) % HISTORY_SIZE;
+	h.count = std::min(h.count + 1, HISTORY_SIZE);
+}
+
+void record(state& data, phase what, clock::time_point start, clock::time_point end) {
+	add_sample(data, what, std::chrono::duration<float, std::milli>(end - start).count());
+
+	if (data.record_trace) {
+		record_trace(data, what, start, end);
+	}
+
+	if (what == phase::tick) {
+		data.tick++;
+	}
+}
+
+void record_gpu(state& data, phase what, clock::time_point start, std::chrono::nanoseconds duration, pass_counters const& counters) {
+	add_sample(data, what, std::chrono::duration<float, std::milli>(duration).count());
+
+	if (data.record_trace) {
+		record_trace(data, what, start, start + std::chrono::duration_cast<clock::duration>(duration), counters);
+	}
+}
+
+const char* get_name(phase what) {
+	switch (what) {
+		case phase::tick:
+			return "Tick";
+		case phase::characters_ai:
+			return "Characters AI";
+		case phase::hunger:
+			return "Hunger";
+		case phase::trade:
+			return "Trade";
+		case phase::promises:
+			return "Promises";
+		case phase::eating:
+			return "Eating";
+		case phase::prices:
+			return "Prices";
+		case phase::movement:
+			return "Movement";
+		case phase::spatial_grid:
+			return "Spatial grid";
+		case phase::critters:
+			return "Critters";
+		case phase::births:
+			return "Births";
+		case phase::gpu_shadows:
+			return "GPU shadows";
+		case phase::gpu_shadow_blur:
+			return "GPU shadow blur";
+		case phase::gpu_terrain:
+			return "GPU terrain";
+		case phase::gpu_things:
+			return "GPU things";
+		case phase::gpu_post:
+			return "GPU post";
+		case phase::gpu_imgui:
+			return "GPU ImGui";
+		default:
+			return "Unknown";
+	}
+}
+
+stats get_stats(state& data, phase what) {
+	auto& h = data.phases[(size_t)what];
+	stats result {};
+	result.samples = h.count;
+	if (h.count == 0) {
+		return result;
+	}
+
+	std::array<float, HISTORY_SIZE> sorted;
+	std::copy(h.samples_ms.begin(), h.samples_ms.begin() + h.count, sorted.begin());
+	std::sort(sorted.begin(), sorted.begin() + h.count);
+
+	float sum = 0.f;
+	for (size_t i = 0; i < h.count; i++) {
+		sum += sorted[i];
+	}
+
+	result.last_ms = h.samples_ms[(h.next + HISTORY_SIZE - 1) % HISTORY_SIZE];
+	result.min_ms = sorted[0];
+	result.avg_ms = sum / (float)h.count;
+	result.p99_ms = sorted[std::min(h.count - 1, h.count * 99 / 100)];
+	return result;
+}
+
+bool dump_chrome_trace(state& data, std::string const& path) {
+	auto file = fopen(path.c_str(), "w");
+	if (!file) {
+		return false;
+	}
+
+	// oldest event first
+	auto start = data.trace.size() < TRACE_CAPACITY ? 0 : data.trace_next;
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	for (size_t i = 0; i < data.trace.size(); i++) {
+		auto& event = data.trace[(start + i) % data.trace.size()];
+		// gpu passes get their own row, placed where they were submitted
+		if (is_gpu(event.what)) {
+			fprintf(
+				file,
+				"%s{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":0,\"tid\":1,"
+				"\"args\":{\"tick\":%u,\"draws\":%u,\"state_changes\":%u,\"vertices\":%llu}}\n",
+				i == 0 ? "" : ",",
+				get_name(event.what),
+				(long long)event.start_us,
+				(long long)event.duration_us,
+				event.tick,
+				event.counters.draws,
+				event.counters.state_changes,
+				(unsigned long long)event.counters.vertices
+			);
+			continue;
+		}
+		fprintf(
+			file,
+			"%s{\"name\":\"%s\",\"cat\":\"tick\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":0,\"tid\":0,\"args\":{\"tick\":%u}}\n",
+			i == 0 ? "" : ",",
+			get_name(event.what),
+			(long long)event.start_us,
+			(long long)event.duration_us,
+			event.tick
+		);
+	}
+	fprintf(file, "]}\n");
+	fclose(file);
+	return true;
+}
+
+}
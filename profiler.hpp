@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// scoped timers for the phases of a tick
+// keeps a rolling window of samples per phase and optionally a trace of every scope
+
+namespace profiler {
+
+enum class phase : uint8_t {
+	tick,
+	characters_ai,
+	hunger,
+	trade,
+	promises,
+	eating,
+	prices,
+	movement,
+	spatial_grid,
+	critters,
+	births,
+	// render passes timed on the gpu, reported a few frames late
+	gpu_shadows,
+	gpu_shadow_blur,
+	gpu_terrain,
+	gpu_things,
+	gpu_post,
+	gpu_imgui,
+	count
+};
+
+constexpr size_t PHASES_COUNT = (size_t)phase::count;
+constexpr size_t CPU_PHASES_COUNT = (size_t)phase::gpu_shadows;
+
+inline bool is_gpu(phase what) {
+	return what >= phase::gpu_shadows && what < phase::count;
+}
+constexpr size_t HISTORY_SIZE = 256;
+constexpr size_t TRACE_CAPACITY = 1 << 16;
+
+struct history {
+	std::array<float, HISTORY_SIZE> samples_ms {};
+	size_t next = 0;
+	size_t count = 0;
+};
+
+// what a render pass submitted, zero for cpu phases
+struct pass_counters {
+	uint32_t draws;
+	uint32_t state_changes;
+	uint64_t vertices;
+};
+
+struct trace_event {
+	int64_t start_us;
+	int64_t duration_us;
+	uint32_t tick;
+	phase what;
+	pass_counters counters;
+};
+
+struct stats {
+	float last_ms;
+	float min_ms;
+	float avg_ms;
+	float p99_ms;
+	size_t samples;
+};
+
+using clock = std::chrono::steady_clock;
+
+struct state {
+	std::array<history, PHASES_COUNT> phases {};
+
+	// ring buffer of the latest scopes, only filled when record_trace is set
+	bool record_trace = false;
+	std::vector<trace_event> trace;
+	size_t trace_next = 0;
+
+	uint32_t tick = 0;
+	clock::time_point origin = clock::now();
+};
+
+void record(state& data, phase what, clock::time_point start, clock::time_point end);
+// the pass was submitted at start, the gpu spent duration on it
+void record_gpu(state& data, phase what, clock::time_point start, std::chrono::nanoseconds duration, pass_counters const& counters);
+
+struct scope {
+	state& data;
+	phase what;
+	clock::time_point start;
+
+	scope(state& data, phase what) : data(data), what(what), start(clock::now()) { }
+	~scope() {
+		record(data, what, start, clock::now());
+	}
+
+	scope(scope const&) = delete;
+	scope& operator=(scope const&) = delete;
+};
+
+const char* get_name(phase what);
+stats get_stats(state& data, phase what);
+
+// writes the recorded scopes in the chrome://tracing json format
+bool dump_chrome_trace(state& data, std::string const& path);
+
+}
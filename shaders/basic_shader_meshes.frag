@@ -4,9 +4,13 @@
 uniform sampler2DArray shadow_map;
 uniform mat4 shadow_transform [10];
 uniform int shadow_layers;
+// moments are prefiltered and may be exponentially warped, see shadow.frag
+uniform float evsm_exponent;
 
 // color and lighting
 uniform vec3 albedo;
+// used instead of albedo by things with a soul
+uniform vec3 albedo_soul;
 uniform vec3 ambient;
 uniform vec3 light_direction;
 uniform vec3 light_color;
@@ -16,8 +20,8 @@ layout (location = 0) out vec4 out_color;
 
 // position things
 in vec3 frag_normal;
-in vec2 texcoord;
 in vec3 position;
+flat in float soul;
 
 vec3 specular(vec3 albedo, vec3 direction) {
 	float cosine = dot(frag_normal, direction);
@@ -38,28 +42,11 @@ vec3 specular(vec3 albedo, vec3 direction) {
 			);
 }
 
-float TonemapRaw(float x)
-{
-	float A = 0.15;
-	float B = 0.50;
-	float C = 0.10;
-	float D = 0.20;
-	float E = 0.02;
-	float F = 0.30;
-	return ((x*(A*x+C*B)+D*E)/(x*(A*x+B)+D*F))-E/F;
-}
-
-float Uncharted2Tonemap(float luma)
-{
-	float W = 11.2;
-	return TonemapRaw(luma) / TonemapRaw(W);
-}
-
 void main()
 {
 	// vec4 texture_value = texture(albedo, texcoord);
 	// vec4 texture_value = vec4(0.9f, 0.9f, 0.9f, 1.f);
-	vec3 albedo_color = albedo;
+	vec3 albedo_color = mix(albedo, albedo_soul, soul);
 
 	// if (texture_value.a <= 0.5) {
 	//     discard;
@@ -96,27 +83,15 @@ void main()
 
 	if (in_shadow_texture)
 	{
-		vec2 sum = vec2(0.0, 0.0);
-		float sum_w = 0.0;
-		const int N = 4;
-		float radius = 1.0;
-		for (int x = -N; x <= N; ++x)
-		{
-			for (int y = -N; y <= N; ++y)
-			{
-				float c = exp(-float(x*x + y*y) / (radius*radius));
-				vec3 texcoord = vec3(shadow_pos.xy + vec2(float(x), float(y)) / 1024.0 / 2.0, current_shadow_layer);
-				sum += c * texture(shadow_map, texcoord).rg;
-				sum_w += c;
-			}
-		}
-
-		vec2 data = sum / sum_w;
-
-		// vec2 data = texture(shadow_map, shadow_pos.xy).rg;
+		vec2 data = texture(shadow_map, vec3(shadow_pos.xy, current_shadow_layer)).rg;
 		float actual_length_of_light_ray = data.r;
 		float sigma = data.g - actual_length_of_light_ray * actual_length_of_light_ray;
 		float potential_length_of_light_ray = shadow_pos.z - 0.001;// ;
+		if (evsm_exponent > 0.0) {
+			potential_length_of_light_ray = exp(evsm_exponent * potential_length_of_light_ray);
+			// half floats round small variances to zero
+			sigma = max(sigma, 0.0001);
+		}
 
 		float length_of_shadow_ray = potential_length_of_light_ray - actual_length_of_light_ray;
 
@@ -148,42 +123,11 @@ void main()
 	vec3 color = albedo_color * light + specular(albedo_color, light_direction) * shadow_factor;
 
 
-	vec3 step_to_camera = (camera_position - position) / 10;
-	vec3 current_position = position + step_to_camera * 0.5;
-	float step_length = length(step_to_camera);
-	float absorbtion = 0.01;
-	vec3 emission = ambient * absorbtion * 1.5;
-	float absorbtion_exp = exp(-absorbtion * step_length);
-
-	for (int i = 0; i < 10 - 1; i++) {
-		color = absorbtion_exp * color + (1 - absorbtion_exp) * emission / absorbtion;
-		if (!in_shadow_texture) {
-			color = color + light_color * exp(-absorbtion * shadow_pos.z) * 0.0003;
-		}
-		current_position = current_position + step_to_camera;
+	// in-scatter outside of the cascades, once per former fog step; shaders/post.frag attenuates it with the surface
+	if (!in_shadow_texture) {
+		color += 9.0 * light_color * exp(-0.01 * shadow_pos.z) * 0.0003;
 	}
 
-
-	float Kr = 0.299;
-	float Kg = 0.587;
-	float Kb = 0.114;
-
-	mat3 toYPbPr = mat3(
-		Kr,     -0.5 * Kr / (1 - Kb),    0.5,
-		Kg,     -0.5 * Kg / (1 - Kb),   -0.5 * Kg / (1 - Kr),
-		Kb,      0.5,                   -0.5 * Kb / (1 - Kr)
-	);
-
-	mat3 fromYPbPr = inverse(toYPbPr);
-
-	vec3 colorYPbPr = toYPbPr * color;
-
-	colorYPbPr.x = Uncharted2Tonemap(colorYPbPr.x);
-
-	color = fromYPbPr * colorYPbPr;
-
-	color = pow(color, vec3(1.0 / 2.2));
-
-
+	// linear and unbounded, the post pass adds fog, tonemapping and gamma
 	out_color = vec4(color, 1.0);
-}
\ No newline at end of file
+}
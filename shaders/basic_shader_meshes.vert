@@ -5,18 +5,41 @@ uniform mat4 view;
 uniform mat4 projection;
 
 layout (location = 0) in vec3 in_position;
-layout (location = 1) in vec3 in_normal;
-layout (location = 2) in vec2 in_texcoord;
-// layout (location = 3) in vec3 instance;
+// octahedral encoding
+layout (location = 1) in vec2 in_normal;
+// x, y, scale, rotation
+layout (location = 3) in vec4 instance;
+layout (location = 4) in float instance_soul;
 
 out vec3 frag_normal;
-out vec2 texcoord;
 out vec3 position;
+flat out float soul;
+
+mat4 instance_transform() {
+	float c = cos(instance.w);
+	float s = sin(instance.w);
+	// translate * scale(xy) * rotate(z)
+	return mat4(
+		vec4(c * instance.z, s * instance.z, 0.0, 0.0),
+		vec4(-s * instance.z, c * instance.z, 0.0, 0.0),
+		vec4(0.0, 0.0, 1.0, 0.0),
+		vec4(instance.x, instance.y, 0.0, 1.0)
+	);
+}
+
+vec3 decode_normal(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(in_position, 1.0);
-	frag_normal = normalize(mat3(model) * in_normal);
-	texcoord = in_texcoord;
-	position = (model * vec4(in_position, 1.0)).xyz;
+	mat4 full_model = model * instance_transform();
+	gl_Position = projection * view * full_model * vec4(in_position, 1.0);
+	frag_normal = normalize(mat3(full_model) * decode_normal(in_normal));
+	position = (full_model * vec4(in_position, 1.0)).xyz;
+	soul = instance_soul;
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#version 330 core
+
+uniform sampler2D color_buffer;
+uniform sampler2D depth_buffer;
+uniform mat4 inverse_projection;
+uniform vec3 ambient;
+
+layout (location = 0) out vec4 out_color;
+
+const float absorbtion = 0.01;
+// YPbPr luma
+const vec3 luma_weights = vec3(0.299, 0.587, 0.114);
+// TonemapRaw(11.2)
+const float tonemap_white = 0.725129;
+
+float TonemapRaw(float x)
+{
+	float A = 0.15;
+	float B = 0.50;
+	float C = 0.10;
+	float D = 0.20;
+	float E = 0.02;
+	float F = 0.30;
+	return ((x*(A*x+C*B)+D*E)/(x*(A*x+B)+D*F))-E/F;
+}
+
+float Uncharted2Tonemap(float luma)
+{
+	return TonemapRaw(luma) / tonemap_white;
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec3 color = texelFetch(color_buffer, pixel, 0).rgb;
+	float depth = texelFetch(depth_buffer, pixel, 0).r;
+
+	// the clear color is shown as it is
+	if (depth >= 1.0) {
+		out_color = vec4(color, 1.0);
+		return;
+	}
+
+	vec2 ndc = gl_FragCoord.xy / vec2(textureSize(color_buffer, 0)) * 2.0 - 1.0;
+	vec4 view_position = inverse_projection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+	float distance = length(view_position.xyz / view_position.w);
+
+	// closed form of the nine marching steps of a tenth of the distance each
+	float transmittance = exp(-absorbtion * 0.9 * distance);
+	vec3 emission = ambient * 1.5;
+	color = transmittance * color + (1.0 - transmittance) * emission;
+
+	// tonemapping luma and keeping chroma shifts all channels by the same amount
+	float luma = dot(color, luma_weights);
+	color += Uncharted2Tonemap(luma) - luma;
+
+	color = pow(color, vec3(1.0 / 2.2));
+
+	out_color = vec4(color, 1.0);
+}
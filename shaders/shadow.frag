@@ -1,10 +1,18 @@
 #version 330 core
 
+// zero for plain moments, otherwise moments of exp(evsm_exponent * z) which survive half floats
+uniform float evsm_exponent;
+
 out vec4 out_color;
 
 void main()
 {
 	float z = gl_FragCoord.z;
+	if (evsm_exponent > 0.0) {
+		float w = exp(evsm_exponent * z);
+		out_color = vec4(w, w * w, 0.0, 0.0);
+		return;
+	}
 	float z_x = dFdx(z);
 	float z_y = dFdy(z);
 	float slope = 0.25 * (z_x * z_x + z_y * z_y);
@@ -4,8 +4,21 @@ uniform mat4 model;
 uniform mat4 transform;
 
 layout (location = 0) in vec3 in_position;
+// x, y, scale, rotation
+layout (location = 3) in vec4 instance;
+
+mat4 instance_transform() {
+	float c = cos(instance.w);
+	float s = sin(instance.w);
+	return mat4(
+		vec4(c * instance.z, s * instance.z, 0.0, 0.0),
+		vec4(-s * instance.z, c * instance.z, 0.0, 0.0),
+		vec4(0.0, 0.0, 1.0, 0.0),
+		vec4(instance.x, instance.y, 0.0, 1.0)
+	);
+}
 
 void main()
 {
-	gl_Position = transform * model * vec4(in_position, 1.0);
+	gl_Position = transform * model * instance_transform() * vec4(in_position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,27 @@
+#version 330 core
+
+uniform sampler2DArray source;
+uniform int layer;
+// one texel along the blurred axis
+uniform vec2 direction;
+
+layout (location = 0) out vec4 out_color;
+
+// one axis of the gaussian which was applied in 2d for every shaded fragment
+void main()
+{
+	const int N = 4;
+	float radius = 1.0;
+	vec2 texcoord = gl_FragCoord.xy / vec2(textureSize(source, 0).xy);
+
+	vec2 sum = vec2(0.0, 0.0);
+	float sum_w = 0.0;
+	for (int i = -N; i <= N; ++i)
+	{
+		float c = exp(-float(i * i) / (radius * radius));
+		sum += c * texture(source, vec3(texcoord + direction * float(i), layer)).rg;
+		sum_w += c;
+	}
+
+	out_color = vec4(sum / sum_w, 0.0, 0.0);
+}
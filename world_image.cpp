@@ -0,0 +1,470 @@
+#include "world_image.hpp"
+
+#include <cstring>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace world_image {
+
+constexpr char MAGIC[4] = {'W', 'I', 'M', 'G'};
+
+// everything in game::state which is neither the container nor the map
+// rng state follows it, see game::save_rng
+struct scalars {
+	uint64_t seed;
+	uint32_t time;
+	uint32_t tick;
+	int32_t price_update_tick;
+	uint32_t rng_size;
+
+	dcon::commodity_id potion;
+	dcon::commodity_id coins;
+	dcon::commodity_id potion_material;
+	dcon::commodity_id raw_food;
+	dcon::commodity_id prepared_food;
+	dcon::commodity_id weapon_service;
+
+	dcon::building_model_id inn;
+	dcon::building_model_id shop;
+	dcon::building_model_id shop_weapon;
+
+	game::skill_ids skills;
+	game::ai_state ai;
+	game::ai_personality personality;
+	game::kinds special_kinds;
+};
+
+size_t align(size_t offset) {
+	return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// first offset from position which has the same place within a page as address
+uint64_t place_like(uint64_t position, std::byte const* address) {
+	auto wanted = (uint64_t)((uintptr_t)address % ALIGNMENT);
+	return position + (wanted + ALIGNMENT - position % ALIGNMENT) % ALIGNMENT;
+}
+
+struct column {
+	std::string name;
+	std::byte* data;
+	size_t size;
+};
+
+template<typename T>
+void add_column(std::vector<column>& result, std::string name, T& first, size_t count) {
+	result.push_back({std::move(name), (std::byte*)&first, sizeof(T) * count});
+}
+
+// large columns of objects which are created while playing, stored as they are in memory
+// everything else in the container is small enough to be serialized
+std::vector<column> get_columns(game::state& game) {
+	std::vector<column> result;
+	add_column(result, "map_height", game.map.height[0], game.map.height.size());
+
+	dcon::thing_id thing {0};
+	auto things = game.data.thing_size();
+	add_column(result, "thing_x", game.data.thing_get_x(thing), things);
+	add_column(result, "thing_y", game.data.thing_get_y(thing), things);
+	add_column(result, "thing_hp", game.data.thing_get_hp(thing), things);
+	add_column(result, "thing_hp_max", game.data.thing_get_hp_max(thing), things);
+	add_column(result, "thing_direction", game.data.thing_get_direction(thing), things);
+	add_column(result, "thing_kind", game.data.thing_get_kind(thing), things);
+	add_column(result, "thing_hunger", game.data.thing_get_hunger(thing), things);
+
+	dcon::building_id building {0};
+	auto buildings = game.data.building_size();
+	add_column(result, "building_tile_x", game.data.building_get_tile_x(building), buildings);
+	add_column(result, "building_tile_y", game.data.building_get_tile_y(building), buildings);
+	add_column(result, "building_building_model", game.data.building_get_building_model(building), buildings);
+
+	dcon::character_id character {0};
+	auto characters = game.data.character_size();
+	add_column(result, "character_weapon_quality", game.data.character_get_weapon_quality(character), characters);
+	add_column(result, "character_mood", game.data.character_get_mood(character), characters);
+	add_column(result, "character_action_timer", game.data.character_get_action_timer(character), characters);
+	add_column(result, "character_action_type", game.data.character_get_action_type(character), characters);
+	add_column(result, "character_ai_type", game.data.character_get_ai_type(character), characters);
+	add_column(result, "character_favourite_shop", game.data.character_get_favourite_shop(character), characters);
+	add_column(result, "character_favourite_inn", game.data.character_get_favourite_inn(character), characters);
+	add_column(result, "character_favourite_shop_weapons", game.data.character_get_favourite_shop_weapons(character), characters);
+	add_column(result, "character_delivers_for_first", game.data.character_get_delivers_for_first(character), characters);
+	add_column(result, "character_delivers_for_second", game.data.character_get_delivers_for_second(character), characters);
+	add_column(result, "character_delivers_for_third", game.data.character_get_delivers_for_third(character), characters);
+
+	// arrays are one column per index
+	for (uint32_t i = 0; i < game.data.commodity_size(); i++) {
+		dcon::commodity_id commodity {dcon::commodity_id::value_base_t(i)};
+		auto index = std::to_string(i);
+		add_column(result, "character_inventory." + index, game.data.character_get_inventory(character, commodity), characters);
+		add_column(result, "character_price_belief_buy." + index, game.data.character_get_price_belief_buy(character, commodity), characters);
+		add_column(result, "character_price_belief_sell." + index, game.data.character_get_price_belief_sell(character, commodity), characters);
+	}
+	for (uint32_t i = 0; i < game.data.skill_size(); i++) {
+		dcon::skill_id skill {dcon::skill_id::value_base_t(i)};
+		add_column(result, "character_skills." + std::to_string(i), game.data.character_get_skills(character, skill), characters);
+	}
+	return result;
+}
+
+// checkpoint record without the columns above
+dcon::load_record serialized_record(game::state& game) {
+	auto record = game.data.make_serialize_record_checkpoint();
+	record.thing_x = false;
+	record.thing_y = false;
+	record.thing_hp = false;
+	record.thing_hp_max = false;
+	record.thing_direction = false;
+	record.thing_kind = false;
+	record.thing_hunger = false;
+	record.building_tile_x = false;
+	record.building_tile_y = false;
+	record.building_building_model = false;
+	record.character_weapon_quality = false;
+	record.character_mood = false;
+	record.character_action_timer = false;
+	record.character_action_type = false;
+	record.character_ai_type = false;
+	record.character_favourite_shop = false;
+	record.character_favourite_inn = false;
+	record.character_favourite_shop_weapons = false;
+	record.character_delivers_for_first = false;
+	record.character_delivers_for_second = false;
+	record.character_delivers_for_third = false;
+	record.character_inventory = false;
+	record.character_price_belief_buy = false;
+	record.character_price_belief_sell = false;
+	record.character_skills = false;
+	return record;
+}
+
+// pads the file up to the start of the next section
+bool write_padding(FILE* file, uint64_t& position, uint64_t to) {
+	static constexpr std::byte zeros[ALIGNMENT] = {};
+	auto size = (size_t)(to - position);
+	position = to;
+	return size == 0 || fwrite(zeros, 1, size, file) == size;
+}
+
+bool write_bytes(FILE* file, uint64_t& position, void const* data, size_t size) {
+	position += size;
+	return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+// sections are written one after the other, only the serialized part of the container
+// goes through a buffer because it can only be serialized into memory
+bool write(game::state& game, std::string const& path) {
+	auto rng_text = game::save_rng(game);
+
+	// padding is written to the file too
+	scalars values;
+	memset((void*)&values, 0, sizeof(scalars));
+	values.seed = game.seed;
+	values.time = game.time;
+	values.tick = game.tick;
+	values.price_update_tick = (int32_t)game.price_update_tick;
+	values.rng_size = (uint32_t)rng_text.size();
+	values.potion = game.potion;
+	values.coins = game.coins;
+	values.potion_material = game.potion_material;
+	values.raw_food = game.raw_food;
+	values.prepared_food = game.prepared_food;
+	values.weapon_service = game.weapon_service;
+	values.inn = game.inn;
+	values.shop = game.shop;
+	values.shop_weapon = game.shop_weapon;
+	values.skills = game.skills;
+	values.ai = game.ai;
+	values.personality = game.personality;
+	values.special_kinds = game.special_kinds;
+
+	auto record = serialized_record(game);
+	auto columns = get_columns(game);
+
+	header result {};
+	memcpy(result.magic, MAGIC, sizeof(MAGIC));
+	result.version = VERSION;
+	result.world_area_tiles = game::WORLD_AREA_TILES;
+	result.scalars_size = sizeof(scalars);
+	result.columns = columns.size();
+
+	auto& container = result.sections[(size_t)section::container];
+	container.offset = align(sizeof(header) + sizeof(column_entry) * columns.size());
+	container.size = game.data.serialize_size(record);
+	auto& rest = result.sections[(size_t)section::scalars];
+	rest.offset = align(container.offset + container.size);
+	rest.size = sizeof(scalars) + rng_text.size();
+
+	std::vector<column_entry> table(columns.size());
+	uint64_t end = rest.offset + rest.size;
+	for (size_t i = 0; i < columns.size(); i++) {
+		if (columns[i].name.size() >= COLUMN_NAME_SIZE) {
+			return false;
+		}
+		memcpy(table[i].name, columns[i].name.data(), columns[i].name.size());
+		table[i].offset = place_like(end, columns[i].data);
+		table[i].size = columns[i].size;
+		end = table[i].offset + table[i].size;
+	}
+
+	std::vector<std::byte> container_data(container.size);
+	auto output = container_data.data();
+	game.data.serialize(output, record);
+
+	auto file = fopen(path.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	uint64_t position = 0;
+	auto ok =
+		write_bytes(file, position, &result, sizeof(header))
+		&& write_bytes(file, position, table.data(), sizeof(column_entry) * table.size())
+		&& write_padding(file, position, container.offset)
+		&& write_bytes(file, position, container_data.data(), container.size)
+		&& write_padding(file, position, rest.offset)
+		&& write_bytes(file, position, &values, sizeof(scalars))
+		&& write_bytes(file, position, rng_text.data(), rng_text.size());
+	for (size_t i = 0; ok && i < columns.size(); i++) {
+		ok = write_padding(file, position, table[i].offset)
+			&& write_bytes(file, position, columns[i].data, columns[i].size);
+	}
+	return fclose(file) == 0 && ok;
+}
+
+bool check_header(mapping const& image, header& info) {
+	if (!image.data || image.size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&info, image.data, sizeof(header));
+	return
+		memcmp(info.magic, MAGIC, sizeof(MAGIC)) == 0
+		&& info.version == VERSION
+		&& info.world_area_tiles == game::WORLD_AREA_TILES
+		&& info.scalars_size == sizeof(scalars)
+		&& info.columns <= (image.size - sizeof(header)) / sizeof(column_entry);
+}
+
+std::byte const* get_section(mapping const& image, section which, size_t& size) {
+	header info;
+	if (!check_header(image, info)) {
+		return nullptr;
+	}
+	auto& entry = info.sections[(size_t)which];
+	if (entry.offset % ALIGNMENT != 0 || entry.offset > image.size || entry.size > image.size - entry.offset) {
+		return nullptr;
+	}
+	size = entry.size;
+	return image.data + entry.offset;
+}
+
+size_t map_column(mapping const& image, column_entry const& entry, std::byte* target);
+
+bool load(game::state& game, mapping const& image, size_t* mapped_bytes) {
+	header info;
+	size_t container_size;
+	size_t rest_size;
+	auto container = get_section(image, section::container, container_size);
+	auto rest = get_section(image, section::scalars, rest_size);
+	if (!container || !rest || !check_header(image, info) || rest_size < sizeof(scalars)) {
+		return false;
+	}
+
+	scalars values;
+	memcpy(&values, rest, sizeof(scalars));
+	if (rest_size != sizeof(scalars) + values.rng_size) {
+		return false;
+	}
+
+	dcon::load_record loaded;
+	game.data.deserialize(container, container + container_size, loaded);
+	// sizes of arrays are not part of the serialized record, they follow their index objects
+	game.data.character_resize_inventory(game.data.commodity_size());
+	game.data.character_resize_price_belief_buy(game.data.commodity_size());
+	game.data.character_resize_price_belief_sell(game.data.commodity_size());
+	game.data.character_resize_skills(game.data.skill_size());
+
+	std::vector<column_entry> table(info.columns);
+	memcpy(table.data(), image.data + sizeof(header), sizeof(column_entry) * table.size());
+	auto columns = get_columns(game);
+	if (columns.size() != table.size()) {
+		return false;
+	}
+	std::unordered_map<std::string, column_entry const*> by_name;
+	for (auto& entry : table) {
+		if (entry.offset > image.size || entry.size > image.size - entry.offset) {
+			return false;
+		}
+		by_name[std::string(entry.name, strnlen(entry.name, COLUMN_NAME_SIZE))] = &entry;
+	}
+
+	size_t mapped = 0;
+	for (auto& item : columns) {
+		auto found = by_name.find(item.name);
+		if (found == by_name.end() || found->second->size != item.size) {
+			return false;
+		}
+		mapped += map_column(image, *found->second, item.data);
+	}
+	if (mapped_bytes) {
+		*mapped_bytes = mapped;
+	}
+
+	if (!game::load_rng(game, rest + sizeof(scalars), values.rng_size)) {
+		return false;
+	}
+
+	game.seed = values.seed;
+	game.time = values.time;
+	game.tick = values.tick;
+	game.price_update_tick = values.price_update_tick;
+	game.potion = values.potion;
+	game.coins = values.coins;
+	game.potion_material = values.potion_material;
+	game.raw_food = values.raw_food;
+	game.prepared_food = values.prepared_food;
+	game.weapon_service = values.weapon_service;
+	game.inn = values.inn;
+	game.shop = values.shop;
+	game.shop_weapon = values.shop_weapon;
+	game.skills = values.skills;
+	game.ai = values.ai;
+	game.personality = values.personality;
+	game.special_kinds = values.special_kinds;
+
+	game::rebuild_derived(game);
+	return true;
+}
+
+mapping::~mapping() {
+	close(*this);
+}
+
+#ifdef _WIN32
+
+bool open(mapping& image, const char* path) {
+	close(image);
+	auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	auto view = GetFileSizeEx(file, &size) && size.QuadPart > 0
+		? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)
+		: nullptr;
+	if (!view) {
+		CloseHandle(file);
+		return false;
+	}
+	auto data = MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(view);
+		CloseHandle(file);
+		return false;
+	}
+	image.data = (std::byte const*)data;
+	image.size = (size_t)size.QuadPart;
+	image.file = file;
+	image.view = view;
+	return true;
+}
+
+void close(mapping& image) {
+	if (!image.data) {
+		return;
+	}
+	UnmapViewOfFile(image.data);
+	CloseHandle(image.view);
+	CloseHandle(image.file);
+	image.data = nullptr;
+	image.size = 0;
+	image.file = nullptr;
+	image.view = nullptr;
+}
+
+// views can not be placed over memory which is already allocated, so columns are copied
+// from the view, which still only reads the pages of the file which are used
+size_t map_column(mapping const& image, column_entry const& entry, std::byte* target) {
+	memcpy(target, image.data + entry.offset, entry.size);
+	return 0;
+}
+
+#else
+
+bool open(mapping& image, const char* path) {
+	close(image);
+	auto file = ::open(path, O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0) {
+		::close(file);
+		return false;
+	}
+	auto data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+	if (data == MAP_FAILED) {
+		::close(file);
+		return false;
+	}
+	image.data = (std::byte const*)data;
+	image.size = (size_t)info.st_size;
+	image.view = data;
+	// kept open for the columns
+	image.descriptor = file;
+	return true;
+}
+
+void close(mapping& image) {
+	if (!image.data) {
+		return;
+	}
+	munmap(image.view, image.size);
+	::close(image.descriptor);
+	image.data = nullptr;
+	image.size = 0;
+	image.view = nullptr;
+	image.descriptor = -1;
+}
+
+// whole pages of the column are replaced by private pages of the file,
+// only the partial pages at its edges are copied
+size_t map_column(mapping const& image, column_entry const& entry, std::byte* target) {
+	auto source = image.data + entry.offset;
+	auto start = (uintptr_t)target;
+	auto end = start + entry.size;
+	auto first = (start + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	auto last = end / ALIGNMENT * ALIGNMENT;
+	if (
+		first < last
+		&& start % ALIGNMENT == entry.offset % ALIGNMENT
+		&& sysconf(_SC_PAGESIZE) == (long)ALIGNMENT
+	) {
+		auto pages = mmap(
+			(void*)first, last - first, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+			image.descriptor, (off_t)(entry.offset + (first - start))
+		);
+		if (pages != MAP_FAILED) {
+			memcpy(target, source, first - start);
+			memcpy((void*)last, source + (last - start), end - last);
+			return last - first;
+		}
+	}
+	memcpy(target, source, entry.size);
+	return 0;
+}
+
+#endif
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "game.hpp"
+
+// worlds saved as one file laid out like the memory of game::state
+// the large columns of the container and the map heights are stored as raw arrays,
+// each at the same offset within a page as the column has in memory, so loading maps
+// the file pages straight onto the columns as private copy on write pages:
+// nothing is read until it is touched, and processes which load the same file share
+// every page they do not write to
+// everything else (small objects, relationships, free lists) is serialized and
+// deserialized as in checkpoints, together with the ids and scalars of game::state
+// on windows, or when a column does not line up, the column is copied from the mapped file instead
+
+namespace world_image {
+
+constexpr uint32_t VERSION = 2;
+constexpr size_t ALIGNMENT = 4096;
+constexpr size_t COLUMN_NAME_SIZE = 48;
+
+enum class section : uint32_t {
+	container,
+	scalars,
+	count
+};
+
+struct section_entry {
+	uint64_t offset;
+	uint64_t size;
+};
+
+// column table follows the header
+struct column_entry {
+	char name[COLUMN_NAME_SIZE];
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct header {
+	char magic[4];
+	uint32_t version;
+	// layout checks: an image is only valid for the build which has the same world size
+	uint32_t world_area_tiles;
+	uint32_t scalars_size;
+	uint64_t columns;
+	section_entry sections[(size_t)section::count];
+};
+
+// read only view of a whole file
+// columns mapped by load stay valid after it is closed
+struct mapping {
+	std::byte const* data = nullptr;
+	size_t size = 0;
+	void* file = nullptr;
+	void* view = nullptr;
+	int descriptor = -1;
+
+	mapping() = default;
+	mapping(mapping const&) = delete;
+	mapping& operator=(mapping const&) = delete;
+	~mapping();
+};
+
+bool open(mapping& image, const char* path);
+void close(mapping& image);
+// checks the header, returns nullptr for a broken image
+std::byte const* get_section(mapping const& image, section which, size_t& size);
+
+bool write(game::state& game, std::string const& path);
+// replaces the world in a default constructed state
+// mapped_bytes receives how much of the columns was mapped instead of copied
+bool load(game::state& game, mapping const& image, size_t* mapped_bytes = nullptr);
+
+}